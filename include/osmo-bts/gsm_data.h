@@ -31,6 +31,7 @@ struct gsm_bts_role_bts {
 			struct osmo_timer_list timer;
 			unsigned int pch_total;
 			unsigned int pch_used;
+			int overload_sent;
 		} ccch;
 		struct {
 			/* Input parameters from OML */
@@ -41,6 +42,22 @@ struct gsm_bts_role_bts {
 	uint8_t ny1;
 	uint8_t max_ta;
 	struct llist_head agch_queue;
+	unsigned int agch_queue_length;
+	unsigned int agch_max_queue_length;
+	unsigned int agch_queue_rej;	/* IMM ASS REJ at the head */
+	struct {
+		unsigned int dropped_full;
+		unsigned int dropped_age;
+		unsigned int merged;	/* pairs sent as IMM ASS EXT */
+	} agch_stats;
+	/* CCCH block utilisation since start */
+	struct {
+		unsigned int agch_total;	/* AGCH blocks */
+		unsigned int agch_used;		/* ... with IMM ASS */
+		unsigned int pch_total;		/* PCH blocks */
+		unsigned int pch_paging;	/* ... with paging */
+		unsigned int pch_agch;		/* ... with IMM ASS */
+	} ccch_stats;
 	struct paging_state *paging_state;
 	char *bsc_oml_host;
 	char *rtp_bind_host;
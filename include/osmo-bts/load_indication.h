@@ -0,0 +1,13 @@
+#ifndef OSMO_BTS_LOAD_IND_H
+#define OSMO_BTS_LOAD_IND_H
+
+#include <osmo-bts/gsm_data.h>
+
+/* periodic CCCH LOAD INDICATION (PCH) towards the BSC */
+void load_timer_start(struct gsm_bts *bts);
+void load_timer_stop(struct gsm_bts *bts);
+
+/* immediate CCCH LOAD INDICATION for a paging that was dropped */
+void load_ind_paging_overload(struct gsm_bts *bts);
+
+#endif
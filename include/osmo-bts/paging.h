@@ -16,16 +16,27 @@ void paging_reset(struct paging_state *ps);
 /* update with new SYSTEM INFORMATION parameters */
 int paging_si_update(struct paging_state *ps, struct gsm48_control_channel_descr *chan_desc);
 
-/* Add an identity to the paging queue */
+/* Add an identity to the paging queue, prio is the eMLPP call priority
+ * (0 = none, 7 = level A); lower priority records are preempted if full */
 int paging_add_identity(struct paging_state *ps, uint8_t paging_group,
-			const uint8_t *identity_lv, uint8_t chan_needed);
+			const uint8_t *identity_lv, uint8_t chan_needed,
+			uint8_t prio);
 
 /* generate paging message for given gsm time */
-int paging_gen_msg(struct paging_state *ps, uint8_t *out_buf, struct gsm_time *gt);
+int paging_gen_msg(struct paging_state *ps, uint8_t *out_buf, struct gsm_time *gt,
+		   int *is_empty);
+
+/* advance record expiry to the given TDMA frame number */
+void paging_fn_tick(struct paging_state *ps, uint32_t fn);
 
 
 /* inspection methods below */
 int paging_group_queue_empty(struct paging_state *ps, uint8_t group);
 int paging_queue_length(struct paging_state *ps);
+unsigned int paging_expired_count(struct paging_state *ps);
+unsigned int paging_preempted_count(struct paging_state *ps);
+
+/* available paging buffer space for the CCCH LOAD INDICATION */
+uint16_t paging_buffer_space(struct paging_state *ps);
 
 #endif
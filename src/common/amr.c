@@ -67,19 +67,21 @@ int amr_parse_mr_conf(struct amr_multirate_conf *amr_mrc,
 		}
 	}
 
+	/* thresholds and hysteresis start at octet 5 of the IE, the
+	 * ones of mode[i] are those between mode i and i+1 */
 	if (num_codecs >= 2) {
-		amr_mrc->mode[0].threshold = mr_conf[1] & 0x3F;
-		amr_mrc->mode[0].hysteresis = mr_conf[2] >> 4;
+		amr_mrc->mode[0].threshold = mr_conf[2] & 0x3F;
+		amr_mrc->mode[0].hysteresis = mr_conf[3] >> 4;
 	}
 	if (num_codecs >= 3) {
 		amr_mrc->mode[1].threshold =
-			((mr_conf[2] & 0xF) << 2) | (mr_conf[3] >> 6);
-		amr_mrc->mode[1].hysteresis = (mr_conf[3] >> 2) & 0x7;
+			((mr_conf[3] & 0xF) << 2) | (mr_conf[4] >> 6);
+		amr_mrc->mode[1].hysteresis = (mr_conf[4] >> 2) & 0xF;
 	}
 	if (num_codecs >= 4) {
-		amr_mrc->mode[3].threshold =
-			((mr_conf[3] & 0x3) << 4) | (mr_conf[4] >> 4);
-		amr_mrc->mode[3].hysteresis = mr_conf[4] & 0xF;
+		amr_mrc->mode[2].threshold =
+			((mr_conf[4] & 0x3) << 4) | (mr_conf[5] >> 4);
+		amr_mrc->mode[2].hysteresis = mr_conf[5] & 0xF;
 	}
 
 	return num_codecs;
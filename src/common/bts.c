@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -32,7 +33,10 @@
 #include <osmocom/core/timer.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/protocol/gsm_04_08.h>
 #include <osmocom/gsm/protocol/gsm_12_21.h>
+#include <osmocom/gsm/gsm_utils.h>
 #include <osmocom/gsm/lapdm.h>
 #include <osmocom/trau/osmo_ortp.h>
 
@@ -42,6 +46,7 @@
 #include <osmo-bts/bts_model.h>
 #include <osmo-bts/rsl.h>
 #include <osmo-bts/oml.h>
+#include <osmo-bts/load_indication.h>
 
 
 struct gsm_network bts_gsmnet = {
@@ -62,10 +67,15 @@ int bts_init(struct gsm_bts *bts)
 	bts->role = btsb = talloc_zero(bts, struct gsm_bts_role_bts);
 
 	INIT_LLIST_HEAD(&btsb->agch_queue);
+	btsb->agch_max_queue_length = 32;
 
 	/* FIXME: make those parameters configurable */
 	btsb->paging_state = paging_init(btsb, 200, 0);
 
+	/* defaults until OML tells us otherwise */
+	btsb->load.ccch.load_ind_thresh = 10;
+	btsb->load.ccch.load_ind_period = 10;
+
 	btsb->rtp_jitter_buf_ms = 100;
 
 	/* set BTS to dependency */
@@ -385,6 +395,14 @@ int trx_link_estab(struct gsm_bts_trx *trx)
 	if (link->state == LINK_STATE_CONNECT)
 		rsl_tx_rf_res(trx);
 
+	/* CCCH load is reported on the RSL link of the BCCH TRX */
+	if (trx == trx->bts->c0) {
+		if (link->state == LINK_STATE_CONNECT)
+			load_timer_start(trx->bts);
+		else
+			load_timer_stop(trx->bts);
+	}
+
 	return 0;
 }
 
@@ -400,19 +418,262 @@ int lchan_init_lapdm(struct gsm_lchan *lchan)
 	return 0;
 }
 
+/* An Immediate Assignment only reaches an MS that still waits for an
+ * answer to one of its last RACH bursts, and T3126 never exceeds 5s
+ * (TS 04.08 11.1.1) */
+#define AGCH_MAX_AGE_FN		1083
+
+/* range of the reduced frame number in a Request Reference */
+#define AGCH_RFN_MODULUS	42432
+
+static int agch_msg_is_rej(struct msgb *msg)
+{
+	return msg->len >= 3 && msg->data[2] == GSM48_MT_RR_IMM_ASS_REJ;
+}
+
+/* number of frames since the (first) RACH burst the message answers,
+ * or -1 if the message has no Request Reference */
+static int agch_msg_age(struct msgb *msg, struct gsm_time *g_time)
+{
+	struct gsm_time rach_time;
+	unsigned int ofs;
+	uint32_t rfn;
+	uint8_t *rr;
+
+	switch (msg->len >= 3 ? msg->data[2] : 0) {
+	case GSM48_MT_RR_IMM_ASS:
+	case GSM48_MT_RR_IMM_ASS_EXT:
+		/* after page mode and channel description */
+		ofs = 7;
+		break;
+	case GSM48_MT_RR_IMM_ASS_REJ:
+		/* after page mode */
+		ofs = 4;
+		break;
+	default:
+		return -1;
+	}
+	if (msg->len < ofs + 3)
+		return -1;
+
+	/* 10.5.2.30 Request Reference: RA, T1', T3, T2 */
+	rr = msg->data + ofs;
+	rach_time.t1 = rr[1] >> 3;
+	rach_time.t3 = ((rr[1] & 7) << 3) | (rr[2] >> 5);
+	rach_time.t2 = rr[2] & 0x1f;
+	rfn = gsm_gsmtime2fn(&rach_time);
+
+	return (g_time->fn % AGCH_RFN_MODULUS + AGCH_RFN_MODULUS - rfn)
+						% AGCH_RFN_MODULUS;
+}
+
+static void agch_unlink(struct gsm_bts_role_bts *btsb, struct msgb *msg)
+{
+	if (agch_msg_is_rej(msg))
+		btsb->agch_queue_rej--;
+	btsb->agch_queue_length--;
+	llist_del(&msg->list);
+}
+
+/* drop a queued message and tell the BSC about it */
+static void agch_discard(struct gsm_bts *bts, struct msgb *msg)
+{
+	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
+
+	agch_unlink(btsb, msg);
+	rsl_tx_delete_ind(bts, msg->data, msg->len);
+	msgb_free(msg);
+}
+
+/* Queue an Immediate Assignment (Reject) for the AGCH.  Rejects go
+ * ahead of all assignments, as they stop the MS from retrying.  If the
+ * queue is full, the oldest assignment is discarded to make room. */
 int bts_agch_enqueue(struct gsm_bts *bts, struct msgb *msg)
 {
 	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
+	int is_rej = agch_msg_is_rej(msg);
+	struct msgb *old;
+	unsigned int i;
+
+	if (btsb->agch_queue_length >= btsb->agch_max_queue_length) {
+		if (btsb->agch_queue_length > btsb->agch_queue_rej) {
+			/* the oldest assignment, right after the rejects */
+			old = llist_entry(btsb->agch_queue.next, struct msgb, list);
+			for (i = 0; i < btsb->agch_queue_rej; i++)
+				old = llist_entry(old->list.next, struct msgb, list);
+		} else if (is_rej && btsb->agch_queue_length) {
+			old = llist_entry(btsb->agch_queue.next, struct msgb, list);
+		} else {
+			btsb->agch_stats.dropped_full++;
+			return -ENOSPC;
+		}
+		LOGP(DRSL, LOGL_NOTICE, "AGCH queue full (%u), discarding "
+			"oldest message\n", btsb->agch_queue_length);
+		agch_discard(bts, old);
+		btsb->agch_stats.dropped_full++;
+	}
 
-	/* FIXME: implement max queue length */
-	msgb_enqueue(&btsb->agch_queue, msg);
+	if (is_rej) {
+		/* behind the rejects that are already queued */
+		struct llist_head *pos = &btsb->agch_queue;
+		for (i = 0; i < btsb->agch_queue_rej; i++)
+			pos = pos->next;
+		llist_add(&msg->list, pos);
+		btsb->agch_queue_rej++;
+	} else
+		llist_add_tail(&msg->list, &btsb->agch_queue);
+	btsb->agch_queue_length++;
 
 	return 0;
 }
 
-struct msgb *bts_agch_dequeue(struct gsm_bts *bts)
+/* Return the head of the AGCH queue without taking it off, discarding
+ * messages that are too old to be of any use to the MS at g_time */
+static struct msgb *agch_peek(struct gsm_bts *bts, struct gsm_time *g_time)
+{
+	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
+	struct msgb *msg;
+
+	while (!llist_empty(&btsb->agch_queue)) {
+		msg = llist_entry(btsb->agch_queue.next, struct msgb, list);
+		if (agch_msg_age(msg, g_time) > AGCH_MAX_AGE_FN) {
+			LOGP(DRSL, LOGL_NOTICE, "Discarding stale AGCH "
+				"message\n");
+			agch_discard(bts, msg);
+			btsb->agch_stats.dropped_age++;
+			continue;
+		}
+		return msg;
+	}
+
+	return NULL;
+}
+
+/* Take the next message for the AGCH block at g_time */
+struct msgb *bts_agch_dequeue(struct gsm_bts *bts, struct gsm_time *g_time)
+{
+	struct msgb *msg = agch_peek(bts, g_time);
+
+	if (msg)
+		agch_unlink(bts_role_bts(bts), msg);
+
+	return msg;
+}
+
+/* Can the Immediate Assignment be merged into an Immediate Assignment
+ * Extended?  That message has no room for a TBF, a Mobile Allocation
+ * per MS, a Starting Time or the IA Rest Octets, so only a dedicated
+ * mode assignment of a non hopping channel qualifies. */
+static int agch_msg_can_merge(struct msgb *msg)
+{
+	struct gsm48_imm_ass *ia = (struct gsm48_imm_ass *) msg->data;
+	unsigned int i;
+
+	if (msg->len < sizeof(*ia) || ia->msg_type != GSM48_MT_RR_IMM_ASS)
+		return 0;
+	/* Dedicated mode or TBF (10.5.2.25b) */
+	if (ia->page_mode & 0xf0)
+		return 0;
+	if (ia->mob_alloc_len)
+		return 0;
+	/* no Starting Time, IA Rest Octets without any content */
+	for (i = sizeof(*ia); i < msg->len; i++) {
+		if (msg->data[i] != 0x2B)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Build an Immediate Assignment Extended (TS 04.08 9.1.19) from two
+ * Immediate Assignments in out_buf, returns the length */
+static int agch_merge_imm_ass(uint8_t *out_buf, struct msgb *msg1,
+			      struct msgb *msg2)
+{
+	struct gsm48_imm_ass *ia1 = (struct gsm48_imm_ass *) msg1->data;
+	struct gsm48_imm_ass *ia2 = (struct gsm48_imm_ass *) msg2->data;
+	struct gsm48_imm_ass_ext *iax = (struct gsm48_imm_ass_ext *) out_buf;
+
+	memset(out_buf, 0x2B, GSM_MACBLOCK_LEN);
+
+	/* everything up to the IAX Rest Octets, which are left empty */
+	iax->l2_plen = ((sizeof(*iax) - 1) << 2) | 1;
+	iax->proto_discr = ia1->proto_discr;
+	iax->msg_type = GSM48_MT_RR_IMM_ASS_EXT;
+	iax->page_mode = ia1->page_mode & 0x0f;
+	iax->chan_desc1 = ia1->chan_desc;
+	iax->req_ref1 = ia1->req_ref;
+	iax->timing_advance1 = ia1->timing_advance;
+	iax->chan_desc2 = ia2->chan_desc;
+	iax->req_ref2 = ia2->req_ref;
+	iax->timing_advance2 = ia2->timing_advance;
+	iax->mob_alloc_len = 0;
+
+	return sizeof(*iax);
+}
+
+/* Fill the CCCH block at gt, which is reserved for AGCH if is_ag_res is
+ * set.  A PCH block whose paging group has nothing to send carries a
+ * queued Immediate Assignment instead, which TS 04.08 3.3.1.1.3 permits
+ * on any CCCH block.  The reverse is of no use, as an MS only listens
+ * to its own paging block.  Returns the length or < 0 if the block is
+ * left unused. */
+int bts_ccch_copy_msg(struct gsm_bts *bts, uint8_t *out_buf, struct gsm_time *gt,
+		      int is_ag_res)
 {
 	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
+	struct msgb *msg;
+	int rc = 0, is_empty;
 
-	return msgb_dequeue(&btsb->agch_queue);
+	if (is_ag_res) {
+		btsb->ccch_stats.agch_total++;
+	} else {
+		rc = paging_gen_msg(btsb->paging_state, out_buf, gt, &is_empty);
+		if (rc < 0)
+			return rc;
+
+		/* PCH utilisation for the CCCH LOAD INDICATION */
+		btsb->load.ccch.pch_total++;
+		btsb->ccch_stats.pch_total++;
+		if (!is_empty) {
+			btsb->load.ccch.pch_used++;
+			btsb->ccch_stats.pch_paging++;
+			return rc;
+		}
+	}
+
+	msg = bts_agch_dequeue(bts, gt);
+	if (!msg) {
+		/* the empty paging message is already in out_buf */
+		return is_ag_res ? -ENOENT : rc;
+	}
+
+	if (is_ag_res)
+		btsb->ccch_stats.agch_used++;
+	else
+		btsb->ccch_stats.pch_agch++;
+
+	/* Two assignments that are next in line share one block.  Both
+	 * must use the same page mode, as there is only one for the
+	 * block. */
+	if (agch_msg_can_merge(msg)) {
+		struct msgb *msg2 = agch_peek(bts, gt);
+
+		if (msg2 && agch_msg_can_merge(msg2) &&
+		    (msg->data[3] & 0x0f) == (msg2->data[3] & 0x0f)) {
+			agch_unlink(btsb, msg2);
+			rc = agch_merge_imm_ass(out_buf, msg, msg2);
+			btsb->agch_stats.merged++;
+			msgb_free(msg2);
+			msgb_free(msg);
+			return rc;
+		}
+	}
+
+	rc = OSMO_MIN(msg->len, GSM_MACBLOCK_LEN);
+	memcpy(out_buf, msg->data, rc);
+	memset(out_buf+rc, 0x2B, GSM_MACBLOCK_LEN-rc);
+	msgb_free(msg);
+
+	return rc;
 }
@@ -19,51 +19,85 @@
  *
  */
 
-#include <rsl.h>
+#include <stdint.h>
 
 #include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
 
-static void reset_load_counters(void)
+#include <osmo-bts/logging.h>
+#include <osmo-bts/gsm_data.h>
+#include <osmo-bts/rsl.h>
+#include <osmo-bts/paging.h>
+#include <osmo-bts/load_indication.h>
+
+static void reset_load_counters(struct gsm_bts_role_bts *btsb)
 {
 	/* re-set the counters */
 	btsb->load.ccch.pch_used = btsb->load.ccch.pch_total = 0;
+	btsb->load.ccch.overload_sent = 0;
+}
+
+static void load_timer_schedule(struct gsm_bts_role_bts *btsb)
+{
+	/* a period of 0 would make us spin in the select loop */
+	osmo_timer_schedule(&btsb->load.ccch.timer,
+			    OSMO_MAX(btsb->load.ccch.load_ind_period, 1), 0);
 }
 
 static void load_timer_cb(void *data)
 {
 	struct gsm_bts *bts = data;
-	struct gsm_bts_role_bts *btsb = FIXME;
+	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
 	unsigned int pch_percent;
 
+	/* no PCH block was scheduled at all, e.g. RF still off */
+	if (btsb->load.ccch.pch_total == 0)
+		goto out;
+
 	/* compute percentages */
 	pch_percent = (btsb->load.ccch.pch_used * 100) / btsb->load.ccch.pch_total;
 
 	if (pch_percent >= btsb->load.ccch.load_ind_thresh) {
 		/* send RSL load indication message to BSC */
-		uint16_t paging_buffer_space = FIXME;
-		rsl_tx_ccch_load_ind_pch(bts, paging_buffer_space);
+		uint16_t buffer_space = paging_buffer_space(btsb->paging_state);
+		LOGP(DRSL, LOGL_DEBUG, "PCH load %u%%, paging buffer space "
+			"%u\n", pch_percent, buffer_space);
+		rsl_tx_ccch_load_ind_pch(bts, buffer_space);
 	}
 
-	reset_load_counters();
+out:
+	reset_load_counters(btsb);
 
 	/* re-schedule the timer */
-	osmo_timer_schedule(&btsb->load.ccch.timer,
-			    btsb->load.ccch.load_ind_period, 0);
+	load_timer_schedule(btsb);
 }
 
-static void load_timer_start(struct gsm_bts *bts)
+void load_timer_start(struct gsm_bts *bts)
 {
-	struct gsm_bts_role_bts *btsb = FIXME;
+	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
 
+	btsb->load.ccch.timer.cb = load_timer_cb;
 	btsb->load.ccch.timer.data = bts;
-	reset_load_counters();
-	osmo_timer_schedule(&btsb->load.ccch.timer,
-			    btsb->load.ccch.load_ind_period, 0);
-
-	return 0
+	reset_load_counters(btsb);
+	load_timer_schedule(btsb);
 }
 
-static void load_timer_stop(struct gsm_bts *bts)
+void load_timer_stop(struct gsm_bts *bts)
 {
+	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
+
 	osmo_timer_del(&btsb->load.ccch.timer);
 }
+
+/* The paging queue is full: tell the BSC right away (at most once per
+ * load indication period) instead of waiting for the timer */
+void load_ind_paging_overload(struct gsm_bts *bts)
+{
+	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
+
+	if (btsb->load.ccch.overload_sent)
+		return;
+
+	rsl_tx_ccch_load_ind_pch(bts, 0);
+	btsb->load.ccch.overload_sent = 1;
+}
@@ -19,21 +19,19 @@
  *
  */
 
-/* TODO:
-	* eMLPP priprity
-	* add P1/P2/P3 rest octets
- */
-
 #include <stdlib.h>
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
-#include <time.h>
 
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/linuxlist.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/bitvec.h>
 
+#include <osmocom/gsm/tlv.h>
 #include <osmocom/gsm/protocol/gsm_04_08.h>
+#include <osmocom/gsm/protocol/gsm_08_58.h>
 #include <osmocom/gsm/gsm0502.h>
 
 #include <osmo-bts/bts.h>
@@ -45,24 +43,119 @@
 #define MAX_PAGING_BLOCKS_CCCH	9
 #define MAX_BS_PA_MFRMS		9
 
+/* entry in the paging schedule for frames that are not in a PCH block */
+#define PAGING_SCHED_NONE	0xff
+
+/* number of buckets in the duplicate-identity hash, must be power of 2 */
+#define PAGING_HASH_SIZE	256
+
+/* Record expiry is driven by a two-level timing wheel that advances by
+ * one tick per 51-multiframe (~235ms).  Level 0 covers the next 64
+ * ticks (~15s), level 1 up to 64*63 ticks (~16min) beyond that. */
+#define PAGING_WHEEL_BITS	6
+#define PAGING_WHEEL_SIZE	(1 << PAGING_WHEEL_BITS)
+#define PAGING_WHEEL_MASK	(PAGING_WHEEL_SIZE-1)
+#define PAGING_WHEEL_MAX	(PAGING_WHEEL_SIZE*(PAGING_WHEEL_SIZE-1))
+
+/* number of 51-multiframes in one hyperframe */
+#define PAGING_HYPERFRAME_MF	(2715648/51)
+
+/* keep un-sent records at least this many ticks, so that each one gets
+ * a chance to be sent even with the longest paging cycle */
+#define PAGING_MIN_TICKS	(2*MAX_BS_PA_MFRMS)
+
+/* number of records moved to their new paging group per call of
+ * paging_fn_tick() or paging_gen_msg() after a CCCH re-configuration */
+#define PAGING_MIGRATE_BUDGET	8
+
+/* PCH blocks of a group a non-TMSI record may be passed over for TYPE 3
+ * before it has to go out in a TYPE 2 or TYPE 1 */
+#define PAGING_OTHER_MAX_WAIT	4
+
+/* eMLPP call priority as coded in TS 04.08 10.5.2.31: 0 is no priority,
+ * 1..5 are levels 4..0, 6 is level B and 7 is level A */
+#define PAGING_PRIO_NUM		8
+
 struct paging_record {
-	struct llist_head list;
-	time_t expiration_time;
+	struct llist_head list;		/* group queue or free list */
+	struct llist_head hash_list;	/* duplicate detection hash bucket */
+	struct llist_head timer_list;	/* expiry timing wheel slot */
+	struct llist_head prio_list;	/* all records of one priority */
+	uint32_t expire_tick;		/* end of the paging lifetime */
+	uint32_t deadline_tick;		/* forced removal by the wheel */
+	uint8_t paging_group;
+	uint8_t sched_gen;		/* schedule the group is valid for */
+	uint8_t prio;			/* eMLPP call priority */
 	uint8_t chan_needed;
 	uint8_t identity_lv[9];
 };
 
+/* Each priority level of a paging group keeps records with a TMSI apart
+ * from those with any other identity, so the densest PAGING REQUEST type
+ * can be chosen by looking at the counters only */
+struct paging_level {
+	struct llist_head tmsi_q;
+	struct llist_head other_q;
+	unsigned int num_tmsi;
+	unsigned int num_other;
+};
+
+struct paging_group {
+	struct paging_level level[PAGING_PRIO_NUM];
+	/* totals over all levels */
+	unsigned int num_tmsi;
+	unsigned int num_other;
+	/* bit n is set if level n is not empty */
+	uint8_t prio_mask;
+	/* blocks sent while a non-TMSI record of the top level waited */
+	unsigned int other_waited;
+};
+
 struct paging_state {
 	/* parameters taken / interpreted from BCCH/CCCH configuration */
 	struct gsm48_control_channel_descr chan_desc;
 
 	/* configured otherwise */
 	unsigned int paging_lifetime; /* in seconds */
+	unsigned int lifetime_ticks; /* in 51-multiframes */
 	unsigned int num_paging_max;
 
+	/* paging group for each FN modulo 51*(BS_PA_MFRMS+2) */
+	uint8_t sched[51*MAX_BS_PA_MFRMS];
+	unsigned int sched_len;
+	unsigned int num_groups;
+
+	/* incremented on every change of the paging groups; records of
+	 * an older generation wait in migrate_q for their new group, those
+	 * without IMSI then in regroup_q until the BSC pages them again */
+	uint8_t sched_gen;
+	struct llist_head migrate_q;
+	struct llist_head regroup_q;
+
 	/* total number of currently active paging records in queue */
 	unsigned int num_paging;
-	struct llist_head paging_queue[MAX_PAGING_BLOCKS_CCCH*MAX_BS_PA_MFRMS];
+	struct paging_group paging_queue[MAX_PAGING_BLOCKS_CCCH*MAX_BS_PA_MFRMS];
+
+	/* pre-allocated pool of num_paging_max records; unused records
+	 * are kept in free_list so that the hot path never allocates */
+	struct paging_record *pool;
+	struct llist_head free_list;
+
+	/* index of all queued records, keyed on the identity LV */
+	struct llist_head paging_hash[PAGING_HASH_SIZE];
+
+	/* all queued records by priority, oldest first, for preemption */
+	struct llist_head prio_list[PAGING_PRIO_NUM];
+	unsigned int num_preempted;
+
+	/* expiry timing wheel */
+	uint32_t cur_tick;
+	int last_mf;		/* -1 until the first frame number */
+	struct llist_head wheel[2][PAGING_WHEEL_SIZE];
+
+	/* number of records removed by the wheel since start */
+	unsigned int num_expired;
+	unsigned int num_expired_logged;
 };
 
 static int tmsi_mi_to_uint(uint32_t *out, const uint8_t *tmsi_lv)
@@ -72,7 +165,7 @@ static int tmsi_mi_to_uint(uint32_t *out, const uint8_t *tmsi_lv)
 	if ((tmsi_lv[1] & 7) != GSM_MI_TYPE_TMSI)
 		return -EINVAL;
 
-	*out = *((uint32_t *)(tmsi_lv+2));
+	memcpy(out, tmsi_lv+2, sizeof(*out));
 
 	return 0;
 }
@@ -97,81 +190,473 @@ static const uint8_t block_by_tdma51[51] = {
 	255,			/* empty */
 };
 
-/* get the paging block number _within_ current 51 multiframe */
-static int get_pag_idx_n(struct paging_state *ps, struct gsm_time *gt)
+/* paging block numbers in a combined CCCH (with SDCCH/4) */
+static const uint8_t block_by_tdma51_comb[51] = {
+	255, 255,		/* FCCH, SCH */
+	255, 255, 255, 255,	/* BCCH */
+	0, 0, 0, 0,		/* B0(6..9) */
+	255, 255,		/* FCCH, SCH */
+	1, 1, 1, 1,		/* B1(12..15) */
+	2, 2, 2, 2,		/* B2(16..19) */
+	255, 255,		/* FCCH, SCH */
+	255, 255, 255, 255,	/* SDCCH/4 D0 */
+	255, 255, 255, 255,	/* SDCCH/4 D1 */
+	255, 255,		/* FCCH, SCH */
+	255, 255, 255, 255,	/* SDCCH/4 D2 */
+	255, 255, 255, 255,	/* SDCCH/4 D3 */
+	255, 255,		/* FCCH, SCH */
+	255, 255, 255, 255,	/* SACCH/4 A0 / A2 */
+	255, 255, 255, 255,	/* SACCH/4 A1 / A3 */
+	255,			/* empty */
+};
+
+/* (re-)compute the paging group of each frame over a complete paging
+ * cycle, so that the PCH RTS path only needs a single table lookup */
+static void paging_build_sched(struct paging_state *ps)
 {
-	int blk_n = block_by_tdma51[gt->t3];
-	int blk_idx;
+	struct gsm48_control_channel_descr *chan_desc = &ps->chan_desc;
+	unsigned int n_pag_blks_51 = gsm0502_get_n_pag_blocks(chan_desc);
+	const uint8_t *blk_by_tdma51;
+	unsigned int i;
 
-	if (blk_n == 255)
-		return -EINVAL;
+	if (chan_desc->ccch_conf == RSL_BCCH_CCCH_CONF_1_C)
+		blk_by_tdma51 = block_by_tdma51_comb;
+	else
+		blk_by_tdma51 = block_by_tdma51;
 
-	blk_idx = blk_n - ps->chan_desc.bs_ag_blks_res;
-	if (blk_idx < 0)
-		return -EINVAL;
+	ps->sched_len = 51 * (chan_desc->bs_pa_mfrms + 2);
+	/* BS_AG_BLKS_RES may exceed the number of CCCH blocks */
+	if ((int) n_pag_blks_51 < 0)
+		n_pag_blks_51 = 0;
+	ps->num_groups = n_pag_blks_51 * (chan_desc->bs_pa_mfrms + 2);
+
+	for (i = 0; i < ps->sched_len; i++) {
+		int blk_n = blk_by_tdma51[i % 51];
+
+		/* not a CCCH block, or one reserved for AGCH */
+		if (blk_n == 255 || blk_n < chan_desc->bs_ag_blks_res) {
+			ps->sched[i] = PAGING_SCHED_NONE;
+			continue;
+		}
 
-	return blk_idx;
+		ps->sched[i] = (blk_n - chan_desc->bs_ag_blks_res) +
+				(i / 51) * n_pag_blks_51;
+	}
 }
 
 /* get paging block index over multiple 51 multiframes */
 static int get_pag_subch_nr(struct paging_state *ps, struct gsm_time *gt)
 {
-	int pag_idx = get_pag_idx_n(ps, gt);
-	unsigned int n_pag_blks_51 = gsm0502_get_n_pag_blocks(&ps->chan_desc);
-	unsigned int mfrm_part;
+	uint8_t group = ps->sched[gt->fn % ps->sched_len];
+
+	if (group == PAGING_SCHED_NONE)
+		return -EINVAL;
+
+	return group;
+}
 
-	if (pag_idx < 0)
-		return pag_idx;
+/* FNV-1a over the complete identity LV */
+static unsigned int paging_hash(const uint8_t *identity_lv)
+{
+	uint32_t h = 2166136261U;
+	unsigned int i;
 
-	mfrm_part = ((gt->fn / 51) % (ps->chan_desc.bs_pa_mfrms+2)) * n_pag_blks_51;
+	for (i = 0; i <= identity_lv[0]; i++) {
+		h ^= identity_lv[i];
+		h *= 16777619U;
+	}
 
-	return pag_idx + mfrm_part;
+	return h & (PAGING_HASH_SIZE-1);
 }
 
+static int pr_is_tmsi(const struct paging_record *pr)
+{
+	if (pr->identity_lv[0] == 5 &&
+	    (pr->identity_lv[1] & 7) == GSM_MI_TYPE_TMSI)
+		return 1;
+	else
+		return 0;
+}
+
+/* add a record to the head or tail of its group sub-queue */
+static void enqueue_pr(struct paging_state *ps, struct paging_record *pr,
+			int at_head)
+{
+	struct paging_group *pg = &ps->paging_queue[pr->paging_group];
+	struct paging_level *pl = &pg->level[pr->prio];
+	struct llist_head *q;
+
+	if (pr_is_tmsi(pr)) {
+		q = &pl->tmsi_q;
+		pl->num_tmsi++;
+		pg->num_tmsi++;
+	} else {
+		q = &pl->other_q;
+		pl->num_other++;
+		pg->num_other++;
+	}
+	pg->prio_mask |= 1 << pr->prio;
+
+	if (at_head)
+		llist_add(&pr->list, q);
+	else
+		llist_add_tail(&pr->list, q);
+}
+
+/* remove a record from its group sub-queue */
+static void unlink_pr(struct paging_state *ps, struct paging_record *pr)
+{
+	struct paging_group *pg = &ps->paging_queue[pr->paging_group];
+	struct paging_level *pl = &pg->level[pr->prio];
+
+	/* still waiting in migrate_q or regroup_q, not accounted in
+	 * any group */
+	if (pr->sched_gen != ps->sched_gen) {
+		llist_del(&pr->list);
+		return;
+	}
+
+	if (pr_is_tmsi(pr)) {
+		pl->num_tmsi--;
+		pg->num_tmsi--;
+	} else {
+		pl->num_other--;
+		pg->num_other--;
+	}
+	if (pl->num_tmsi + pl->num_other == 0)
+		pg->prio_mask &= ~(1 << pr->prio);
+
+	llist_del(&pr->list);
+}
+
+/* highest non-empty priority level of a group */
+static struct paging_level *top_level(struct paging_group *pg)
+{
+	int prio;
+
+	for (prio = PAGING_PRIO_NUM-1; prio > 0; prio--) {
+		if (pg->prio_mask & (1 << prio))
+			break;
+	}
+
+	return &pg->level[prio];
+}
+
+/* last three digits of an IMSI mobile identity LV, or -1 */
+static int imsi_lv_mod_1000(const uint8_t *identity_lv)
+{
+	unsigned int i, val;
+
+	if (identity_lv[0] < 1 ||
+	    (identity_lv[1] & 7) != GSM_MI_TYPE_IMSI)
+		return -1;
+
+	val = identity_lv[1] >> 4;
+	for (i = 2; i <= identity_lv[0]; i++) {
+		val = (val * 10 + (identity_lv[i] & 0xf)) % 1000;
+		/* filler of an even number of digits */
+		if ((identity_lv[i] >> 4) != 0xf)
+			val = (val * 10 + (identity_lv[i] >> 4)) % 1000;
+	}
+
+	return val;
+}
+
+/* Paging group of a record under the current schedule.  For an IMSI it
+ * is computed like the BSC does (TS 05.02 6.5.2, single CCCH).  The
+ * group of any other identity is only known to the BSC, so it is -1. */
+static int paging_remap_group(struct paging_state *ps,
+			      const struct paging_record *pr)
+{
+	int imsi_mod_1000 = imsi_lv_mod_1000(pr->identity_lv);
+
+	if (imsi_mod_1000 >= 0)
+		return imsi_mod_1000 % ps->num_groups;
+
+	return -1;
+}
+
+/* move a bounded number of records from migrate_q to their new group.
+ * A record whose group we cannot compute waits in regroup_q for the
+ * repeated PAGING COMMAND of the BSC, see paging_add_identity(), or
+ * else expires. */
+static void paging_migrate_step(struct paging_state *ps, unsigned int budget)
+{
+	struct paging_record *pr;
+	int group;
+
+	if (ps->num_groups == 0)
+		return;
+
+	while (budget-- && !llist_empty(&ps->migrate_q)) {
+		pr = llist_entry(ps->migrate_q.next, struct paging_record, list);
+		llist_del(&pr->list);
+		group = paging_remap_group(ps, pr);
+		if (group < 0) {
+			llist_add_tail(&pr->list, &ps->regroup_q);
+			continue;
+		}
+		pr->paging_group = group;
+		pr->sched_gen = ps->sched_gen;
+		enqueue_pr(ps, pr, 0);
+	}
+}
+
+/* take the oldest record of the TMSI or the other sub-queue of the
+ * highest priority level that has one */
+static struct paging_record *dequeue_pr(struct paging_state *ps,
+					struct paging_group *pg, int tmsi)
+{
+	struct paging_level *pl;
+	struct paging_record *pr;
+	int prio;
+
+	for (prio = PAGING_PRIO_NUM-1; prio > 0; prio--) {
+		pl = &pg->level[prio];
+		if (tmsi ? pl->num_tmsi : pl->num_other)
+			break;
+	}
+	pl = &pg->level[prio];
+
+	if (tmsi)
+		pr = llist_entry(pl->tmsi_q.next, struct paging_record, list);
+	else
+		pr = llist_entry(pl->other_q.next, struct paging_record, list);
+	unlink_pr(ps, pr);
+
+	return pr;
+}
+
+/* take the next record in strict priority order, preferring non-TMSI
+ * identities within a level as only TYPE 1 can carry two of them */
+static struct paging_record *dequeue_pr_prio(struct paging_state *ps,
+					     struct paging_group *pg)
+{
+	return dequeue_pr(ps, pg, top_level(pg)->num_other == 0);
+}
+
+/* take a record from the pre-allocated pool */
+static struct paging_record *paging_record_get(struct paging_state *ps)
+{
+	struct paging_record *pr;
+
+	if (llist_empty(&ps->free_list))
+		return NULL;
+
+	pr = llist_entry(ps->free_list.next, struct paging_record, list);
+	llist_del(&pr->list);
+	ps->num_paging++;
+
+	return pr;
+}
+
+/* return a record (already removed from its group queue) to the pool */
+static void paging_record_put(struct paging_state *ps, struct paging_record *pr)
+{
+	llist_del(&pr->hash_list);
+	llist_del(&pr->timer_list);
+	llist_del(&pr->prio_list);
+	llist_add(&pr->list, &ps->free_list);
+	ps->num_paging--;
+}
+
+/* put a record into the wheel slot matching its deadline_tick */
+static void paging_wheel_add(struct paging_state *ps, struct paging_record *pr)
+{
+	uint32_t delta = pr->deadline_tick - ps->cur_tick;
+
+	if ((int32_t) delta <= 0)
+		delta = 1;
+	else if (delta > PAGING_WHEEL_MAX)
+		delta = PAGING_WHEEL_MAX;
+	pr->deadline_tick = ps->cur_tick + delta;
+
+	if (delta < PAGING_WHEEL_SIZE)
+		llist_add_tail(&pr->timer_list,
+			&ps->wheel[0][pr->deadline_tick & PAGING_WHEEL_MASK]);
+	else
+		llist_add_tail(&pr->timer_list,
+			&ps->wheel[1][(pr->deadline_tick >> PAGING_WHEEL_BITS)
+							& PAGING_WHEEL_MASK]);
+}
+
+/* (re-)start the lifetime of a record */
+static void paging_record_arm(struct paging_state *ps, struct paging_record *pr)
+{
+	pr->expire_tick = ps->cur_tick + ps->lifetime_ticks;
+	pr->deadline_tick = ps->cur_tick +
+			OSMO_MAX(ps->lifetime_ticks, PAGING_MIN_TICKS);
+	paging_wheel_add(ps, pr);
+}
+
+/* advance the wheel by one 51-multiframe */
+static void paging_wheel_tick(struct paging_state *ps)
+{
+	struct paging_record *pr, *pr2;
+	struct llist_head *slot;
+
+	ps->cur_tick++;
+
+	/* level 0 wrapped: cascade the next level 1 slot down */
+	if ((ps->cur_tick & PAGING_WHEEL_MASK) == 0) {
+		slot = &ps->wheel[1][(ps->cur_tick >> PAGING_WHEEL_BITS)
+							& PAGING_WHEEL_MASK];
+		llist_for_each_entry_safe(pr, pr2, slot, timer_list) {
+			llist_del(&pr->timer_list);
+			llist_add_tail(&pr->timer_list,
+				&ps->wheel[0][pr->deadline_tick & PAGING_WHEEL_MASK]);
+		}
+	}
+
+	slot = &ps->wheel[0][ps->cur_tick & PAGING_WHEEL_MASK];
+	llist_for_each_entry_safe(pr, pr2, slot, timer_list) {
+		unlink_pr(ps, pr);
+		paging_record_put(ps, pr);
+		ps->num_expired++;
+	}
+}
+
+/* advance paging time to the given TDMA frame number */
+void paging_fn_tick(struct paging_state *ps, uint32_t fn)
+{
+	int mf = fn / 51;
+	unsigned int n;
+
+	paging_migrate_step(ps, PAGING_MIGRATE_BUDGET);
+
+	if (ps->last_mf < 0) {
+		ps->last_mf = mf;
+		return;
+	}
+
+	n = (mf - ps->last_mf + PAGING_HYPERFRAME_MF) % PAGING_HYPERFRAME_MF;
+	ps->last_mf = mf;
+
+	/* a jump backwards (L1 restart) simply re-synchronizes */
+	if (n > PAGING_HYPERFRAME_MF/2)
+		return;
+
+	/* after a longer gap everything in the wheel is due anyway */
+	if (n > PAGING_WHEEL_SIZE*PAGING_WHEEL_SIZE)
+		n = PAGING_WHEEL_SIZE*PAGING_WHEEL_SIZE;
+
+	while (n--)
+		paging_wheel_tick(ps);
+
+	if (ps->num_expired != ps->num_expired_logged) {
+		LOGP(DPAG, LOGL_INFO, "Expired %u paging records, queue_len=%u\n",
+			ps->num_expired - ps->num_expired_logged, ps->num_paging);
+		ps->num_expired_logged = ps->num_expired;
+	}
+}
+
+/* make room for a record of the given priority by removing the oldest
+ * record of the lowest priority below it */
+static int paging_preempt(struct paging_state *ps, uint8_t prio)
+{
+	struct paging_record *pr;
+	int i;
+
+	for (i = 0; i < prio; i++) {
+		if (llist_empty(&ps->prio_list[i]))
+			continue;
+		pr = llist_entry(ps->prio_list[i].next, struct paging_record,
+				 prio_list);
+		LOGP(DPAG, LOGL_NOTICE, "Queue full, preempting paging of "
+			"priority %u for priority %u\n", pr->prio, prio);
+		unlink_pr(ps, pr);
+		paging_record_put(ps, pr);
+		ps->num_preempted++;
+		return 0;
+	}
+
+	return -ENOSPC;
+}
 
 /* Add an identity to the paging queue */
 int paging_add_identity(struct paging_state *ps, uint8_t paging_group,
-			const uint8_t *identity_lv, uint8_t chan_needed)
+			const uint8_t *identity_lv, uint8_t chan_needed,
+			uint8_t prio)
 {
-	struct llist_head *group_q = &ps->paging_queue[paging_group];
+	struct llist_head *hash_q;
 	struct paging_record *pr;
 
-	if (ps->num_paging >= ps->num_paging_max) {
-		LOGP(DPAG, LOGL_NOTICE, "Dropping paging, queue full (%u)\n",
-			ps->num_paging);
-		return -ENOSPC;
+	if (*identity_lv + 1 > sizeof(pr->identity_lv))
+		return -E2BIG;
+
+	prio &= PAGING_PRIO_NUM-1;
+
+	if (paging_group >= ps->num_groups) {
+		if (ps->num_groups == 0) {
+			LOGP(DPAG, LOGL_ERROR, "Dropping paging, no paging "
+				"blocks in the CCCH configuration\n");
+			return -EINVAL;
+		}
+		/* BSC may still use the previous CCCH configuration */
+		LOGP(DPAG, LOGL_NOTICE, "Paging group %u out of range, "
+			"using %u\n", paging_group,
+			paging_group % ps->num_groups);
+		paging_group %= ps->num_groups;
 	}
 
+	hash_q = &ps->paging_hash[paging_hash(identity_lv)];
+
 	/* Check if we already have this identity */
-	llist_for_each_entry(pr, group_q, list) {
-		if (identity_lv[0] == pr->identity_lv[0] &&
-		    !memcmp(identity_lv+1, pr->identity_lv+1, identity_lv[0])) {
+	llist_for_each_entry(pr, hash_q, hash_list) {
+		if (identity_lv[0] != pr->identity_lv[0] ||
+		    memcmp(identity_lv+1, pr->identity_lv+1, identity_lv[0]))
+			continue;
+		/* the BSC tells us the new group of a record that was
+		 * not yet migrated, so we can move it right away */
+		if (pr->sched_gen != ps->sched_gen) {
+			unlink_pr(ps, pr);
+			pr->paging_group = paging_group;
+			pr->sched_gen = ps->sched_gen;
+			enqueue_pr(ps, pr, 1);
+		}
+		if (pr->paging_group == paging_group) {
 			LOGP(DPAG, LOGL_INFO, "Ignoring duplicate paging\n");
-			pr->expiration_time = time(NULL) + ps->paging_lifetime;
+			/* a repetition may raise the priority */
+			if (prio > pr->prio) {
+				unlink_pr(ps, pr);
+				pr->prio = prio;
+				enqueue_pr(ps, pr, 1);
+				llist_del(&pr->prio_list);
+				llist_add_tail(&pr->prio_list,
+						&ps->prio_list[prio]);
+			}
+			llist_del(&pr->timer_list);
+			paging_record_arm(ps, pr);
 			return -EEXIST;
 		}
 	}
 
-	pr = talloc_zero(ps, struct paging_record);
+	if (ps->num_paging >= ps->num_paging_max &&
+	    paging_preempt(ps, prio) < 0) {
+		LOGP(DPAG, LOGL_NOTICE, "Dropping paging, queue full (%u)\n",
+			ps->num_paging);
+		return -ENOSPC;
+	}
+
+	pr = paging_record_get(ps);
 	if (!pr)
 		return -ENOMEM;
 
-	if (*identity_lv + 1 > sizeof(pr->identity_lv)) {
-		talloc_free(pr);
-		return -E2BIG;
-	}
-
 	LOGP(DPAG, LOGL_INFO, "Add paging to queue (group=%u, queue_len=%u)\n",
-		paging_group, ps->num_paging+1);
+		paging_group, ps->num_paging);
 
-	pr->expiration_time = time(NULL) + ps->paging_lifetime;
+	pr->paging_group = paging_group;
+	pr->sched_gen = ps->sched_gen;
+	pr->prio = prio;
 	pr->chan_needed = chan_needed;
 	memcpy(&pr->identity_lv, identity_lv, identity_lv[0]+1);
 
 	/* enqueue the new identity to the HEAD of the queue,
 	 * to ensure it will be paged quickly at least once.  */
-	llist_add(&pr->list, group_q);
-	ps->num_paging++;
+	enqueue_pr(ps, pr, 1);
+	llist_add(&pr->hash_list, hash_q);
+	llist_add_tail(&pr->prio_list, &ps->prio_list[prio]);
+	paging_record_arm(ps, pr);
 
 	return 0;
 }
@@ -220,7 +705,8 @@ static int fill_paging_type_2(uint8_t *out_buf, const uint8_t *tmsi1_lv,
 	cur = out_buf + sizeof(*pt2);
 
 	if (identity3_lv)
-		cur = lv_put(pt2->data, identity3_lv[0], identity3_lv+1);
+		cur = tlv_put(pt2->data, GSM48_IE_MOBILE_ID, identity3_lv[0],
+			      identity3_lv+1);
 
 	pt2->l2_plen = L2_PLEN(cur - out_buf);
 
@@ -247,55 +733,100 @@ static int fill_paging_type_3(uint8_t *out_buf, const uint8_t *tmsi1_lv,
 	tmsi_mi_to_uint(&pt3->tmsi3, tmsi3_lv);
 	tmsi_mi_to_uint(&pt3->tmsi4, tmsi4_lv);
 
-	cur = out_buf + sizeof(*pt3);
+	/* cneed3/cneed4 of the struct are really the start of the P3 rest
+	 * octets, which are L/H coded and not part of the length */
+	cur = (uint8_t *) &pt3->tmsi4 + sizeof(pt3->tmsi4);
+
+	pt3->l2_plen = L2_PLEN(cur - out_buf);
 
 	return cur - out_buf;
 }
 
-static const uint8_t empty_id_lv[] = { 0x01, 0xF0 };
+/* PAGING REQUEST TYPE 1 with an empty identity and no rest octets, as
+ * sent for every PCH block without a paging */
+#define EMPTY_PAGING_LEN	6
+static const uint8_t empty_paging_block[GSM_MACBLOCK_LEN] = {
+	L2_PLEN(EMPTY_PAGING_LEN), GSM48_PDISC_RR, GSM48_MT_RR_PAG_REQ_1,
+	GSM48_PM_NORMAL, 0x01, 0xF0,
+	0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
+	0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
+};
 
-static struct paging_record *dequeue_pr(struct llist_head *group_q)
+/* one optional 3 bit eMLPP priority field of the rest octets */
+static int put_prio(struct bitvec *bv, uint8_t prio)
 {
-	struct paging_record *pr;
-
-	pr = llist_entry(group_q->next, struct paging_record, list);
-	llist_del(&pr->list);
+	if (!prio)
+		return bitvec_set_bit(bv, L);
 
-	return pr;
+	if (bv->cur_bit + 4 > bv->data_len * 8)
+		return -ENOSPC;
+	bitvec_set_bit(bv, H);
+	return bitvec_set_uint(bv, prio, 3);
 }
 
-static int pr_is_imsi(struct paging_record *pr)
+/* P1/P2/P3 rest octets (TS 04.08 10.5.2.23-25) after a message of len
+ * octets.  Absent fields are coded as L, which is exactly the 0x2B
+ * padding, so only the channel needed for the third and fourth identity
+ * and the eMLPP priorities ever need to be written. */
+static void fill_rest_octets(uint8_t *out_buf, int len,
+			     struct paging_record **pr, unsigned int num_pr)
 {
-	if ((pr->identity_lv[1] & 7) == GSM_MI_TYPE_IMSI)
-		return 1;
-	else
-		return 0;
-}
+	struct bitvec bv;
+	uint8_t cn3 = 0, cn4 = 0;
+	unsigned int i;
+	int rc = 0;
 
-static void sort_pr_tmsi_imsi(struct paging_record *pr[], unsigned int n)
-{
-	int i, j;
-	struct paging_record *t;
+	memset(out_buf+len, 0x2B, GSM_MACBLOCK_LEN-len);
 
-	if (n < 2)
+	if (num_pr > 2)
+		cn3 = pr[2]->chan_needed & 3;
+	if (num_pr > 3)
+		cn4 = pr[3]->chan_needed & 3;
+	for (i = 0; i < num_pr; i++) {
+		if (pr[i]->prio)
+			break;
+	}
+	if (i == num_pr && !cn3 && !cn4)
 		return;
 
-	/* simple bubble sort */
-	for (i = n-2; i >= 0; i--) {
-		for (j=0; j<=i ; j++) {
-			if (pr_is_imsi(pr[j]) > pr_is_imsi(pr[j+1])) {
-				t = pr[j];
-				pr[j] = pr[j+1];
-				pr[j+1] = t;
-			}
-		}
+	bv.data = out_buf + len;
+	bv.data_len = GSM_MACBLOCK_LEN - len;
+	bv.cur_bit = 0;
+
+	switch (out_buf[2]) {
+	case GSM48_MT_RR_PAG_REQ_2:
+		/* CN3 */
+		if (cn3) {
+			bitvec_set_bit(&bv, H);
+			bitvec_set_uint(&bv, cn3, 2);
+		} else
+			rc = bitvec_set_bit(&bv, L);
+		break;
+	case GSM48_MT_RR_PAG_REQ_3:
+		/* CN3, CN4 */
+		if (cn3 || cn4) {
+			bitvec_set_bit(&bv, H);
+			bitvec_set_uint(&bv, cn3, 2);
+			bitvec_set_uint(&bv, cn4, 2);
+		} else
+			rc = bitvec_set_bit(&bv, L);
+		break;
 	}
+
+	/* NLN(PCH) */
+	if (rc == 0)
+		rc = bitvec_set_bit(&bv, L);
+
+	/* Priority 1..n, the rest is truncated if it does not fit */
+	for (i = 0; i < num_pr && rc == 0; i++)
+		rc = put_prio(&bv, pr[i]->prio);
 }
 
 /* generate paging message for given gsm time */
-int paging_gen_msg(struct paging_state *ps, uint8_t *out_buf, struct gsm_time *gt)
+int paging_gen_msg(struct paging_state *ps, uint8_t *out_buf, struct gsm_time *gt,
+		   int *is_empty)
 {
-	struct llist_head *group_q;
+	struct paging_group *pg;
 	int group;
 	int len;
 
@@ -307,36 +838,40 @@ int paging_gen_msg(struct paging_state *ps, uint8_t *out_buf, struct gsm_time *g
 		return -1;
 	}
 
-	group_q = &ps->paging_queue[group];
+	/* make progress on a re-configuration even without MPH-TIME */
+	paging_migrate_step(ps, PAGING_MIGRATE_BUDGET);
+
+	pg = &ps->paging_queue[group];
 
-	/* There is nobody to be paged, send Type1 with two empty ID */
-	if (llist_empty(group_q)) {
+	*is_empty = 0;
+
+	/* There is nobody to be paged, send Type1 with an empty ID */
+	if (pg->num_tmsi + pg->num_other == 0) {
+		*is_empty = 1;
 		//DEBUGP(DPAG, "Tx PAGING TYPE 1 (empty)\n");
-		len = fill_paging_type_1(out_buf, empty_id_lv, 0,
-					 NULL, 0);
+		memcpy(out_buf, empty_paging_block, GSM_MACBLOCK_LEN);
+		len = EMPTY_PAGING_LEN;
 	} else {
+		struct paging_level *top = top_level(pg);
 		struct paging_record *pr[4];
 		unsigned int num_pr = 0;
-		time_t now = time(NULL);
-		unsigned int i, num_imsi = 0;
-
-		/* get (if we have) up to four paging records */
-		for (i = 0; i < ARRAY_SIZE(pr); i++) {
-			if (llist_empty(group_q))
-				break;
-			pr[i] = dequeue_pr(group_q);
-			num_pr++;
-
-			/* count how many IMSIs are among them */
-			if (pr_is_imsi(pr[i]))
-				num_imsi++;
-		}
-
-		/* make sure the TMSIs are ahead of the IMSIs in the array */
-		sort_pr_tmsi_imsi(pr, num_pr);
-
-		if (num_pr == 4 && num_imsi == 0) {
-			/* No IMSI: easy case, can use TYPE 3 */
+		unsigned int i;
+		int need_other = 0;
+		int other_waiting = top->num_other, other_sent = 0;
+
+		/* with more than one priority level in use, the highest
+		 * one must be served first, even at the cost of packing */
+		if (pg->prio_mask & (pg->prio_mask - 1))
+			need_other = top->num_other;
+
+		/* a steady stream of TMSIs would fill TYPE 3 for ever */
+		if (other_waiting && pg->other_waited >= PAGING_OTHER_MAX_WAIT)
+			need_other = OSMO_MAX(need_other, 1);
+
+		if (pg->num_tmsi >= 4 && !need_other) {
+			/* No IMSI needed: easy case, can use TYPE 3 */
+			for (i = 0; i < 4; i++)
+				pr[num_pr++] = dequeue_pr(ps, pg, 1);
 			DEBUGP(DPAG, "Tx PAGING TYPE 3 (4 TMSI)\n");
 			len = fill_paging_type_3(out_buf, pr[0]->identity_lv,
 						 pr[0]->chan_needed,
@@ -344,8 +879,14 @@ int paging_gen_msg(struct paging_state *ps, uint8_t *out_buf, struct gsm_time *g
 						 pr[1]->chan_needed,
 						 pr[2]->identity_lv,
 						 pr[3]->identity_lv);
-		} else if (num_pr >= 3 && num_imsi <= 1) {
-			/* 3 or 4, of which only up to 1 is IMSI */
+		} else if (pg->num_tmsi >= 2 &&
+			   pg->num_tmsi + pg->num_other >= 3 &&
+			   need_other < 2) {
+			/* 2 TMSI plus one more; prefer a non-TMSI for the
+			 * third slot, as TMSIs pack better later on */
+			pr[num_pr++] = dequeue_pr(ps, pg, 1);
+			pr[num_pr++] = dequeue_pr(ps, pg, 1);
+			pr[num_pr++] = dequeue_pr(ps, pg, pg->num_other == 0);
 			DEBUGP(DPAG, "Tx PAGING TYPE 2 (2 TMSI,1 xMSI)\n");
 			len = fill_paging_type_2(out_buf,
 						 pr[0]->identity_lv,
@@ -353,61 +894,90 @@ int paging_gen_msg(struct paging_state *ps, uint8_t *out_buf, struct gsm_time *g
 						 pr[1]->identity_lv,
 						 pr[1]->chan_needed,
 						 pr[2]->identity_lv);
-			if (num_pr == 4) {
-				/* re-add #4 for next time */
-				llist_add(&pr[3]->list, group_q);
-				pr[3] = NULL;
-			}
-		} else if (num_pr == 1) {
-			DEBUGP(DPAG, "Tx PAGING TYPE 1 (1 xMSI,1 empty)\n");
-			len = fill_paging_type_1(out_buf, pr[0]->identity_lv,
-						 pr[0]->chan_needed, NULL, 0);
 		} else {
-			/* 2 (any type) or
-			 * 3 or 4, of which only 2 will be sent */
-			DEBUGP(DPAG, "Tx PAGING TYPE 1 (2 xMSI)\n");
-			len = fill_paging_type_1(out_buf, pr[0]->identity_lv,
-						 pr[0]->chan_needed,
-						 pr[1]->identity_lv,
-						 pr[1]->chan_needed);
-			if (num_pr >= 3) {
-				/* re-add #4 for next time */
-				llist_add(&pr[2]->list, group_q);
-				pr[2] = NULL;
-			}
-			if (num_pr == 4) {
-				/* re-add #4 for next time */
-				llist_add(&pr[3]->list, group_q);
-				pr[3] = NULL;
+			while (num_pr < 2 && pg->num_tmsi + pg->num_other)
+				pr[num_pr++] = dequeue_pr_prio(ps, pg);
+			if (num_pr == 1) {
+				DEBUGP(DPAG, "Tx PAGING TYPE 1 (1 xMSI,1 empty)\n");
+				len = fill_paging_type_1(out_buf, pr[0]->identity_lv,
+							 pr[0]->chan_needed, NULL, 0);
+			} else {
+				DEBUGP(DPAG, "Tx PAGING TYPE 1 (2 xMSI)\n");
+				len = fill_paging_type_1(out_buf, pr[0]->identity_lv,
+							 pr[0]->chan_needed,
+							 pr[1]->identity_lv,
+							 pr[1]->chan_needed);
 			}
 		}
 
+		fill_rest_octets(out_buf, len, pr, num_pr);
+
+		for (i = 0; i < num_pr; i++) {
+			if (!pr_is_tmsi(pr[i]))
+				other_sent = 1;
+		}
+		if (other_waiting && !other_sent)
+			pg->other_waited++;
+		else
+			pg->other_waited = 0;
+
 		for (i = 0; i < num_pr; i++) {
-			/* skip those that we might have re-added above */
-			if (pr[i] == NULL)
-				continue;
 			/* check if we can expire the paging record,
 			 * or if we need to re-queue it */
-			if (pr[i]->expiration_time >= now) {
-				talloc_free(pr[i]);
-				ps->num_paging--;
+			if ((int32_t)(ps->cur_tick - pr[i]->expire_tick) >= 0) {
+				paging_record_put(ps, pr[i]);
 				LOGP(DPAG, LOGL_INFO, "Removed paging record, queue_len=%u\n",
 					ps->num_paging);
 			} else
-				llist_add_tail(&pr[i]->list, group_q);
+				enqueue_pr(ps, pr[i], 0);
 		}
 	}
-	memset(out_buf+len, 0x2B, GSM_MACBLOCK_LEN-len);
 	return len;
 }
 
 int paging_si_update(struct paging_state *ps, struct gsm48_control_channel_descr *chan_desc)
 {
+	unsigned int i;
+	int changed;
+
 	LOGP(DPAG, LOGL_INFO, "Paging SI update\n");
 
-	memcpy(&ps->chan_desc, chan_desc, sizeof(chan_desc));
+	changed = chan_desc->ccch_conf != ps->chan_desc.ccch_conf ||
+		  chan_desc->bs_ag_blks_res != ps->chan_desc.bs_ag_blks_res ||
+		  chan_desc->bs_pa_mfrms != ps->chan_desc.bs_pa_mfrms;
+
+	memcpy(&ps->chan_desc, chan_desc, sizeof(*chan_desc));
+	if (!changed)
+		return 0;
+
+	paging_build_sched(ps);
+
+	/* The paging groups have changed, so every queued record has to
+	 * be re-bucketed.  Splicing all group queues into migrate_q is
+	 * O(groups); the records themselves are moved a few at a time by
+	 * paging_migrate_step() so the PCH never stalls on a long queue. */
+	ps->sched_gen++;
+	for (i = 0; i < ARRAY_SIZE(ps->paging_queue); i++) {
+		struct paging_group *pg = &ps->paging_queue[i];
+		int prio;
+
+		for (prio = 0; prio < PAGING_PRIO_NUM; prio++) {
+			struct paging_level *pl = &pg->level[prio];
 
-	/* FIXME: do we need to re-sort the old paging_records? */
+			llist_splice_init(&pl->tmsi_q, &ps->migrate_q);
+			llist_splice_init(&pl->other_q, &ps->migrate_q);
+			pl->num_tmsi = 0;
+			pl->num_other = 0;
+		}
+		pg->num_tmsi = 0;
+		pg->num_other = 0;
+		pg->prio_mask = 0;
+		pg->other_waited = 0;
+	}
+
+	if (ps->num_paging)
+		LOGP(DPAG, LOGL_INFO, "Paging groups changed, migrating %u "
+			"paging records\n", ps->num_paging);
 
 	return 0;
 }
@@ -439,10 +1009,40 @@ struct paging_state *paging_init(void *ctx, unsigned int num_paging_max,
 		return NULL;
 
 	ps->paging_lifetime = paging_lifetime;
+	/* round up to full 51-multiframes of 6120/26 ms each */
+	ps->lifetime_ticks = (paging_lifetime * 26000 + 6119) / 6120;
 	ps->num_paging_max = num_paging_max;
+	ps->last_mf = -1;
+	INIT_LLIST_HEAD(&ps->migrate_q);
+	INIT_LLIST_HEAD(&ps->regroup_q);
+	paging_build_sched(ps);
+
+	for (i = 0; i < ARRAY_SIZE(ps->paging_queue); i++) {
+		struct paging_group *pg = &ps->paging_queue[i];
+		int prio;
 
-	for (i = 0; i < ARRAY_SIZE(ps->paging_queue); i++)
-		INIT_LLIST_HEAD(&ps->paging_queue[i]);
+		for (prio = 0; prio < PAGING_PRIO_NUM; prio++) {
+			INIT_LLIST_HEAD(&pg->level[prio].tmsi_q);
+			INIT_LLIST_HEAD(&pg->level[prio].other_q);
+		}
+	}
+	for (i = 0; i < ARRAY_SIZE(ps->paging_hash); i++)
+		INIT_LLIST_HEAD(&ps->paging_hash[i]);
+	for (i = 0; i < ARRAY_SIZE(ps->prio_list); i++)
+		INIT_LLIST_HEAD(&ps->prio_list[i]);
+	for (i = 0; i < PAGING_WHEEL_SIZE; i++) {
+		INIT_LLIST_HEAD(&ps->wheel[0][i]);
+		INIT_LLIST_HEAD(&ps->wheel[1][i]);
+	}
+
+	ps->pool = talloc_zero_array(ps, struct paging_record, num_paging_max);
+	if (!ps->pool) {
+		talloc_free(ps);
+		return NULL;
+	}
+	INIT_LLIST_HEAD(&ps->free_list);
+	for (i = 0; i < num_paging_max; i++)
+		llist_add_tail(&ps->pool[i].list, &ps->free_list);
 
 	if (!initialized) {
 		osmo_signal_register_handler(SS_GLOBAL, paging_signal_cbfn, NULL);
@@ -455,13 +1055,14 @@ void paging_reset(struct paging_state *ps)
 {
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(ps->paging_queue); i++) {
-		struct llist_head *queue = &ps->paging_queue[i];
-		struct paging_record *pr, *pr2;
-		llist_for_each_entry_safe(pr, pr2, queue, list) {
-			llist_del(&pr->list);
-			talloc_free(pr);
-			ps->num_paging--;
+	/* every queued record, including those waiting for migration */
+	for (i = 0; i < ARRAY_SIZE(ps->prio_list); i++) {
+		while (!llist_empty(&ps->prio_list[i])) {
+			struct paging_record *pr;
+			pr = llist_entry(ps->prio_list[i].next,
+					 struct paging_record, prio_list);
+			unlink_pr(ps, pr);
+			paging_record_put(ps, pr);
 		}
 	}
 
@@ -478,10 +1079,30 @@ int paging_group_queue_empty(struct paging_state *ps, uint8_t grp)
 {
 	if (grp >= ARRAY_SIZE(ps->paging_queue))
 		return 1;
-	return llist_empty(&ps->paging_queue[grp]);
+	return ps->paging_queue[grp].num_tmsi +
+		ps->paging_queue[grp].num_other == 0;
 }
 
 int paging_queue_length(struct paging_state *ps)
 {
 	return ps->num_paging;
 }
+
+unsigned int paging_expired_count(struct paging_state *ps)
+{
+	return ps->num_expired;
+}
+
+unsigned int paging_preempted_count(struct paging_state *ps)
+{
+	return ps->num_preempted;
+}
+
+/* number of further paging records that can be stored (TS 08.58 9.3.15) */
+uint16_t paging_buffer_space(struct paging_state *ps)
+{
+	if (ps->num_paging >= ps->num_paging_max)
+		return 0;
+
+	return OSMO_MIN(ps->num_paging_max - ps->num_paging, 0xffff);
+}
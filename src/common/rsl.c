@@ -42,6 +42,7 @@
 #include <osmo-bts/signal.h>
 #include <osmo-bts/bts_model.h>
 #include <osmo-bts/measurement.h>
+#include <osmo-bts/load_indication.h>
 
 //#define FAKE_CIPH_MODE_COMPL
 
@@ -337,12 +338,29 @@ int rsl_tx_ccch_load_ind_pch(struct gsm_bts *bts, uint16_t paging_avail)
 	return abis_rsl_sendmsg(msg);
 }
 
+/* 8.5.4 DELETE INDICATION */
+int rsl_tx_delete_ind(struct gsm_bts *bts, const uint8_t *ia, uint8_t ia_len)
+{
+	struct msgb *msg;
+
+	LOGP(DRSL, LOGL_NOTICE, "Sending Delete Indication\n");
+
+	msg = rsl_msgb_alloc(sizeof(struct abis_rsl_cchan_hdr));
+	if (!msg)
+		return -ENOMEM;
+	msgb_tlv_put(msg, RSL_IE_FULL_IMM_ASS_INFO, ia_len, ia);
+	rsl_cch_push_hdr(msg, RSL_MT_DELETE_IND, RSL_CHAN_PCH_AGCH);
+	msg->trx = bts->c0;
+
+	return abis_rsl_sendmsg(msg);
+}
+
 /* 8.5.5 PAGING COMMAND */
 static int rsl_rx_paging_cmd(struct gsm_bts_trx *trx, struct msgb *msg)
 {
 	struct gsm_bts_role_bts *btsb = trx->bts->role;
 	struct tlv_parsed tp;
-	uint8_t chan_needed = 0, paging_group;
+	uint8_t chan_needed = 0, prio = 0, paging_group;
 	const uint8_t *identity_lv;
 	int rc;
 
@@ -358,10 +376,14 @@ static int rsl_rx_paging_cmd(struct gsm_bts_trx *trx, struct msgb *msg)
 	if (TLVP_PRESENT(&tp, RSL_IE_CHAN_NEEDED))
 		chan_needed = *TLVP_VAL(&tp, RSL_IE_CHAN_NEEDED);
 
+	if (TLVP_PRESENT(&tp, RSL_IE_EMLPP_PRIO))
+		prio = *TLVP_VAL(&tp, RSL_IE_EMLPP_PRIO) & 7;
+
 	rc = paging_add_identity(btsb->paging_state, paging_group,
-				 identity_lv, chan_needed);
-	if (rc < 0) {
-		/* FIXME: notfiy the BSC somehow ?*/
+				 identity_lv, chan_needed, prio);
+	if (rc == -ENOSPC) {
+		/* let the BSC throttle before more pagings get lost */
+		load_ind_paging_overload(trx->bts);
 	}
 
 	return 0;
@@ -451,6 +473,7 @@ static int rsl_rx_imm_ass(struct gsm_bts_trx *trx, struct msgb *msg)
 	/* put into the AGCH queue of the BTS */
 	if (bts_agch_enqueue(trx->bts, msg) < 0) {
 		/* if there is no space in the queue: send DELETE IND */
+		rsl_tx_delete_ind(trx->bts, msg->data, msg->len);
 		msgb_free(msg);
 	}
 
@@ -504,6 +527,49 @@ int rsl_tx_chan_act_ack(struct gsm_lchan *lchan, struct gsm_time *gtime)
 	return abis_rsl_sendmsg(msg);
 }
 
+/* 8.4.3 sending CHANnel ACTIVation Negative ACK for an lchan whose
+ * activation has failed in the L1 */
+int rsl_tx_chan_act_nack(struct gsm_lchan *lchan, uint8_t cause)
+{
+	struct msgb *msg;
+	uint8_t chan_nr = gsm_lchan2chan_nr(lchan);
+
+	LOGP(DRSL, LOGL_NOTICE, "%s Tx CHAN ACT NACK: cause = 0x%02x\n",
+		gsm_lchan_name(lchan), cause);
+
+	msg = rsl_msgb_alloc(sizeof(struct abis_rsl_dchan_hdr));
+	if (!msg)
+		return -ENOMEM;
+
+	/* 9.3.26 Cause */
+	msgb_tlv_put(msg, RSL_IE_CAUSE, 1, &cause);
+	rsl_dch_push_hdr(msg, RSL_MT_CHAN_ACTIV_NACK, chan_nr);
+	msg->trx = lchan->ts->trx;
+
+	return abis_rsl_sendmsg(msg);
+}
+
+/* 8.4.8 sending CONNection FAILure INDication */
+int rsl_tx_conn_fail(struct gsm_lchan *lchan, uint8_t cause)
+{
+	struct msgb *msg;
+	uint8_t chan_nr = gsm_lchan2chan_nr(lchan);
+
+	LOGP(DRSL, LOGL_NOTICE, "%s Tx CONN FAIL IND: cause = 0x%02x\n",
+		gsm_lchan_name(lchan), cause);
+
+	msg = rsl_msgb_alloc(sizeof(struct abis_rsl_dchan_hdr));
+	if (!msg)
+		return -ENOMEM;
+
+	/* 9.3.26 Cause */
+	msgb_tlv_put(msg, RSL_IE_CAUSE, 1, &cause);
+	rsl_dch_push_hdr(msg, RSL_MT_CONN_FAIL, chan_nr);
+	msg->trx = lchan->ts->trx;
+
+	return abis_rsl_sendmsg(msg);
+}
+
 /* 8.4.3 sending CHANnel ACTIVation Negative ACK */
 static int rsl_tx_chan_nack(struct gsm_bts_trx *trx, struct msgb *msg, uint8_t cause)
 {
@@ -330,6 +330,8 @@ static void net_dump_nmstate(struct vty *vty, struct gsm_nm_state *nms)
 
 static void bts_dump_vty(struct vty *vty, struct gsm_bts *bts)
 {
+	struct gsm_bts_role_bts *btsb = bts_role_bts(bts);
+
 	vty_out(vty, "BTS %u is of %s type in band %s, has CI %u LAC %u, "
 		"BSIC %u, TSC %u and %u TRX%s",
 		bts->nr, "FIXME", gsm_band_name(bts->band),
@@ -345,6 +347,19 @@ static void bts_dump_vty(struct vty *vty, struct gsm_bts *bts)
 	net_dump_nmstate(vty, &bts->mo.nm_state);
 	vty_out(vty, "  Site Mgr NM State: ");
 	net_dump_nmstate(vty, &bts->site_mgr.mo.nm_state);
+	vty_out(vty, "  Paging: %u pending requests, %u expired, "
+		"%u preempted%s", paging_queue_length(btsb->paging_state),
+		paging_expired_count(btsb->paging_state),
+		paging_preempted_count(btsb->paging_state), VTY_NEWLINE);
+	vty_out(vty, "  AGCH: %u queued, %u dropped (queue full), "
+		"%u dropped (too old), %u merged%s", btsb->agch_queue_length,
+		btsb->agch_stats.dropped_full, btsb->agch_stats.dropped_age,
+		btsb->agch_stats.merged, VTY_NEWLINE);
+	vty_out(vty, "  CCCH: AGCH blocks %u (%u used), PCH blocks %u "
+		"(%u paging, %u IMM ASS)%s", btsb->ccch_stats.agch_total,
+		btsb->ccch_stats.agch_used, btsb->ccch_stats.pch_total,
+		btsb->ccch_stats.pch_paging, btsb->ccch_stats.pch_agch,
+		VTY_NEWLINE);
 #if 0
 	vty_out(vty, "  Paging: %u pending requests, %u free slots%s",
 		paging_pending_requests_nr(bts),
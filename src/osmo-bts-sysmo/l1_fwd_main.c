@@ -86,6 +86,17 @@ int l1if_handle_sysprim(struct femtol1_hdl *fl1h, struct msgb *msg)
 	return osmo_wqueue_enqueue(&l1fh->udp_wq[MQ_SYS_WRITE], msg);
 }
 
+/* msgb for a primitive read from the HW.  The proxy has no pool, as
+ * the primitives are forwarded over UDP rather than answered. */
+struct msgb *l1if_rx_msgb_get(struct femtol1_hdl *fl1h)
+{
+	struct msgb *msg = msgb_alloc_headroom(2048, 128, "1l_fd");
+
+	if (msg)
+		msg->l1h = msg->data;
+
+	return msg;
+}
 
 /* data has arrived on the udp socket */
 static int udp_read_cb(struct osmo_fd *ofd)
@@ -163,7 +174,6 @@ int main(int argc, char **argv)
 
 	/* allocate new femtol1_handle */
 	fl1h = talloc_zero(NULL, struct femtol1_hdl);
-	INIT_LLIST_HEAD(&fl1h->wlc_list);
 
 	/* open the actual hardware transport */
 	rc = l1if_transport_open(fl1h);
@@ -20,6 +20,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -58,6 +59,17 @@
 #define MIN_QUAL_RACH	 5.0f	/* at least  5 dB C/I */
 #define MIN_QUAL_NORM	-0.5f	/* at least -1 dB C/I */
 
+/* number of TDMA frames after which the frame number wraps */
+#define GSM_HYPERFRAME		(2048 * 26 * 51)
+
+/* seconds to wait for a confirmation from the L1 (for each try) */
+#define L1_REQ_TIMEOUT_L1	10
+#define L1_REQ_TIMEOUT_SYS	30
+/* tries after the first one, before the L1 is reset */
+#define L1_REQ_RETRIES		1
+/* L1 resets without success, before we give up and exit */
+#define L1_RECOVERY_MAX		3
+
 struct wait_l1_conf {
 	struct llist_head list;		/* internal linked list */
 	struct osmo_timer_list timer;	/* timer for L1 timeout */
@@ -65,25 +77,202 @@ struct wait_l1_conf {
 	unsigned int is_sys_prim;	/* is this a system (1) or L1 (0) primitive */
 	l1if_compl_cb *cb;
 	void *cb_data;
+	struct femtol1_hdl *fl1h;
+	void *prim;			/* copy of the request, for a retry */
+	unsigned int prim_len;
+	unsigned int retries;
+	unsigned int timeout_secs;
 };
 
+/* does the confirmation tell which request it belongs to?  Those of
+ * MPH-(DE)ACTIVATE name the timeslot and SAPI, the others nothing. */
+static int wlc_conf_identifies(const struct wait_l1_conf *wlc)
+{
+	if (wlc->is_sys_prim)
+		return 0;
+
+	switch (wlc->conf_prim_id) {
+	case GsmL1_PrimId_MphActivateCnf:
+	case GsmL1_PrimId_MphDeactivateCnf:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* could the confirmation in l1p be the one for the request of wlc? */
+static int wlc_conf_matches(const struct wait_l1_conf *wlc,
+			    const GsmL1_Prim_t *l1p)
+{
+	const GsmL1_Prim_t *req = wlc->prim;
+
+	switch (l1p->id) {
+	case GsmL1_PrimId_MphActivateCnf:
+		return req->u.mphActivateReq.u8Tn ==
+				l1p->u.mphActivateCnf.u8Tn &&
+		       req->u.mphActivateReq.sapi ==
+				l1p->u.mphActivateCnf.sapi;
+	case GsmL1_PrimId_MphDeactivateCnf:
+		return req->u.mphDeactivateReq.u8Tn ==
+				l1p->u.mphDeactivateCnf.u8Tn &&
+		       req->u.mphDeactivateReq.sapi ==
+				l1p->u.mphDeactivateCnf.sapi;
+	default:
+		return 1;
+	}
+}
+
 static void release_wlc(struct wait_l1_conf *wlc)
 {
 	osmo_timer_del(&wlc->timer);
 	talloc_free(wlc);
 }
 
+/* build the confirmation of the L1 request of wlc that the L1 will
+ * not send anymore, with the given status */
+static struct msgb *wlc_fail_conf(struct wait_l1_conf *wlc,
+				  GsmL1_Status_t status)
+{
+	GsmL1_Prim_t *req = wlc->prim;
+	struct msgb *msg = l1p_msgb_alloc();
+	GsmL1_Prim_t *l1p;
+
+	if (!msg)
+		return NULL;
+
+	l1p = msgb_l1prim(msg);
+	memset(l1p, 0, sizeof(*l1p));
+	l1p->id = wlc->conf_prim_id;
+
+	switch (l1p->id) {
+	case GsmL1_PrimId_MphInitCnf:
+		l1p->u.mphInitCnf.status = status;
+		break;
+	case GsmL1_PrimId_MphCloseCnf:
+		l1p->u.mphCloseCnf.status = status;
+		break;
+	case GsmL1_PrimId_MphConnectCnf:
+		l1p->u.mphConnectCnf.status = status;
+		break;
+	case GsmL1_PrimId_MphDisconnectCnf:
+		l1p->u.mphDisconnectCnf.status = status;
+		break;
+	case GsmL1_PrimId_MphActivateCnf:
+		l1p->u.mphActivateCnf.status = status;
+		l1p->u.mphActivateCnf.u8Tn = req->u.mphActivateReq.u8Tn;
+		l1p->u.mphActivateCnf.sapi = req->u.mphActivateReq.sapi;
+		break;
+	case GsmL1_PrimId_MphDeactivateCnf:
+		l1p->u.mphDeactivateCnf.status = status;
+		l1p->u.mphDeactivateCnf.u8Tn = req->u.mphDeactivateReq.u8Tn;
+		l1p->u.mphDeactivateCnf.sapi = req->u.mphDeactivateReq.sapi;
+		break;
+	case GsmL1_PrimId_MphConfigCnf:
+		l1p->u.mphConfigCnf.status = status;
+		l1p->u.mphConfigCnf.cfgParamId = req->u.mphConfigReq.cfgParamId;
+		l1p->u.mphConfigCnf.cfgParams = req->u.mphConfigReq.cfgParams;
+		break;
+	case GsmL1_PrimId_MphMeasureCnf:
+		l1p->u.mphMeasureCnf.status = status;
+		break;
+	default:
+		msgb_free(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+/* fail all requests waiting for a confirmation.  The call-backs of
+ * the L1 requests get a confirmation with status Timeout, so that they
+ * can NACK towards the BSC and clean up.  The SYS requests are only
+ * dropped, the recovery does the L1 reset and RF activation again. */
+static void flush_wlc(struct femtol1_hdl *fl1h)
+{
+	LLIST_HEAD(l1_list);
+	struct wait_l1_conf *wlc, *wlc2;
+	struct msgb *msg;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fl1h->wlc_sys); i++) {
+		llist_for_each_entry_safe(wlc, wlc2, &fl1h->wlc_sys[i], list) {
+			llist_del(&wlc->list);
+			release_wlc(wlc);
+		}
+	}
+
+	/* a call-back may send new requests, so only call back once
+	 * the waiting ones are off the lists */
+	for (i = 0; i < ARRAY_SIZE(fl1h->wlc_l1); i++)
+		llist_splice_init(&fl1h->wlc_l1[i], &l1_list);
+
+	llist_for_each_entry_safe(wlc, wlc2, &l1_list, list) {
+		llist_del(&wlc->list);
+		msg = wlc_fail_conf(wlc, GsmL1_Status_Timeout);
+		if (msg)
+			wlc->cb(msg, wlc->cb_data);
+		else
+			LOGP(DL1C, LOGL_ERROR, "Dropping request waiting "
+				"for %s\n", get_value_string(femtobts_l1prim_names,
+							 wlc->conf_prim_id));
+		release_wlc(wlc);
+	}
+}
+
+/* send the request of wlc once more */
+static int resend_wlc(struct wait_l1_conf *wlc)
+{
+	struct femtol1_hdl *fl1h = wlc->fl1h;
+	struct osmo_wqueue *wqueue;
+	struct msgb *msg;
+	int rc;
+
+	if (wlc->is_sys_prim) {
+		msg = sysp_msgb_alloc();
+		wqueue = &fl1h->write_q[MQ_SYS_WRITE];
+	} else {
+		msg = l1p_msgb_alloc();
+		wqueue = &fl1h->write_q[MQ_L1_WRITE];
+	}
+	if (!msg)
+		return -ENOMEM;
+
+	memcpy(msg->l1h, wlc->prim, OSMO_MIN(wlc->prim_len, msgb_l1len(msg)));
+
+	rc = osmo_wqueue_enqueue(wqueue, msg);
+	if (rc < 0)
+		msgb_free(msg);
+
+	return rc;
+}
+
 static void l1if_req_timeout(void *data)
 {
 	struct wait_l1_conf *wlc = data;
+	const char *name;
 
 	if (wlc->is_sys_prim)
-		LOGP(DL1C, LOGL_FATAL, "Timeout waiting for SYS primitive %s\n",
-			get_value_string(femtobts_sysprim_names, wlc->conf_prim_id));
+		name = get_value_string(femtobts_sysprim_names, wlc->conf_prim_id);
 	else
-		LOGP(DL1C, LOGL_FATAL, "Timeout waiting for L1 primitive %s\n",
-			get_value_string(femtobts_l1prim_names, wlc->conf_prim_id));
-	exit(23);
+		name = get_value_string(femtobts_l1prim_names, wlc->conf_prim_id);
+
+	/* only a request whose confirmation names it can be sent again,
+	 * otherwise a late confirmation of the first one could complete
+	 * the next request of the same kind */
+	if (wlc_conf_identifies(wlc) && wlc->retries < L1_REQ_RETRIES &&
+	    resend_wlc(wlc) == 0) {
+		LOGP(DL1C, LOGL_ERROR, "Timeout waiting for %s primitive %s, "
+			"retrying\n", wlc->is_sys_prim ? "SYS" : "L1", name);
+		wlc->retries++;
+		osmo_timer_schedule(&wlc->timer, wlc->timeout_secs, 0);
+		return;
+	}
+
+	LOGP(DL1C, LOGL_ERROR, "Timeout waiting for %s primitive %s\n",
+		wlc->is_sys_prim ? "SYS" : "L1", name);
+
+	/* this releases wlc along with all other pending requests */
+	l1if_recover(wlc->fl1h, "L1 request timeout");
 }
 
 /* send a request primitive to the L1 and schedule completion call-back */
@@ -98,6 +287,7 @@ int l1if_req_compl(struct femtol1_hdl *fl1h, struct msgb *msg,
 	wlc = talloc_zero(fl1h, struct wait_l1_conf);
 	wlc->cb = cb;
 	wlc->cb_data = data;
+	wlc->fl1h = fl1h;
 
 	/* Make sure we actually have received a REQUEST type primitive */
 	if (is_system_prim == 0) {
@@ -115,7 +305,7 @@ int l1if_req_compl(struct femtol1_hdl *fl1h, struct msgb *msg,
 		wlc->is_sys_prim = 0;
 		wlc->conf_prim_id = femtobts_l1prim_req2conf[l1p->id];
 		wqueue = &fl1h->write_q[MQ_L1_WRITE];
-		timeout_secs = 30;
+		timeout_secs = L1_REQ_TIMEOUT_L1;
 	} else {
 		FemtoBts_Prim_t *sysp = msgb_sysprim(msg);
 
@@ -131,14 +321,24 @@ int l1if_req_compl(struct femtol1_hdl *fl1h, struct msgb *msg,
 		wlc->is_sys_prim = 1;
 		wlc->conf_prim_id = femtobts_sysprim_req2conf[sysp->id];
 		wqueue = &fl1h->write_q[MQ_SYS_WRITE];
-		timeout_secs = 30;
+		timeout_secs = L1_REQ_TIMEOUT_SYS;
 	}
 
-	/* enqueue the message in the queue and add wsc to list */
+	/* keep a copy in case the request needs to be sent again */
+	wlc->prim_len = msgb_l1len(msg);
+	wlc->prim = talloc_memdup(wlc, msg->l1h, wlc->prim_len);
+	wlc->timeout_secs = timeout_secs;
+
+	/* enqueue the message in the queue and add wsc to the tail of
+	 * the list of those waiting for the same confirmation */
 	osmo_wqueue_enqueue(wqueue, msg);
-	llist_add(&wlc->list, &fl1h->wlc_list);
+	if (is_system_prim)
+		llist_add_tail(&wlc->list, &fl1h->wlc_sys[wlc->conf_prim_id]);
+	else
+		llist_add_tail(&wlc->list, &fl1h->wlc_l1[wlc->conf_prim_id]);
 
-	/* schedule a timer for 10 seconds. If DSP fails to respond, we terminate */
+	/* schedule a timer. If DSP fails to respond, we retry and then
+	 * reset the L1, see l1if_req_timeout() */
 	wlc->timer.data = wlc;
 	wlc->timer.cb = l1if_req_timeout;
 	osmo_timer_schedule(&wlc->timer, timeout_secs, 0);
@@ -168,6 +368,116 @@ struct msgb *sysp_msgb_alloc(void)
 	return msg;
 }
 
+/* msgb_free() of a pool msgb ends up here.  Refusing the free keeps
+ * the memory around, so the msgb can be queued for its next use. */
+static int l1prim_pool_destructor(struct msgb *msg)
+{
+	struct l1prim_pool *pool = msg->dst;
+
+	/* the pool has been released, the last msgb takes it along */
+	if (pool->released) {
+		if (--pool->size == 0)
+			talloc_free(pool);
+		return 0;
+	}
+
+	msgb_reset(msg);
+	msg->dst = pool;
+	llist_add(&msg->list, &pool->free_list);
+	pool->num_free++;
+
+	return -1;
+}
+
+static struct l1prim_pool *l1prim_pool_alloc(void *ctx, unsigned int msg_size,
+					      unsigned int num)
+{
+	struct l1prim_pool *pool;
+	struct msgb *msg;
+
+	pool = talloc_zero(ctx, struct l1prim_pool);
+	if (!pool)
+		return NULL;
+
+	INIT_LLIST_HEAD(&pool->free_list);
+	pool->msg_size = msg_size;
+
+	for (pool->size = 0; pool->size < num; pool->size++) {
+		msg = msgb_alloc(msg_size, "l1_prim_pool");
+		if (!msg)
+			break;
+		msg->dst = pool;
+		talloc_set_destructor(msg, l1prim_pool_destructor);
+		llist_add(&msg->list, &pool->free_list);
+		pool->num_free++;
+	}
+
+	return pool;
+}
+
+/* free the unused msgbs of the pool.  The ones still in use are freed
+ * for real once they are done with, and the last of them frees the
+ * pool, so nothing is put back into freed memory. */
+static void l1prim_pool_release(struct l1prim_pool *pool)
+{
+	struct msgb *msg, *msg2;
+
+	pool->released = 1;
+
+	llist_for_each_entry_safe(msg, msg2, &pool->free_list, list) {
+		llist_del(&msg->list);
+		talloc_set_destructor(msg, NULL);
+		msgb_free(msg);
+	}
+	pool->size -= pool->num_free;
+	pool->num_free = 0;
+
+	if (pool->size == 0)
+		talloc_free(pool);
+}
+
+/* take an empty msgb from the pool, or allocate one if it is empty */
+static struct msgb *l1prim_pool_get(struct l1prim_pool *pool)
+{
+	struct msgb *msg;
+
+	if (llist_empty(&pool->free_list)) {
+		pool->stats.alloc++;
+		return msgb_alloc(pool->msg_size, "l1_prim");
+	}
+
+	msg = llist_entry(pool->free_list.next, struct msgb, list);
+	llist_del(&msg->list);
+	pool->num_free--;
+	pool->stats.get++;
+
+	return msg;
+}
+
+/* get a msgb containing a zeroed GsmL1_Prim_t from the pool */
+struct msgb *l1p_msgb_get(struct femtol1_hdl *fl1h)
+{
+	struct msgb *msg = l1prim_pool_get(fl1h->tx_pool);
+
+	if (msg) {
+		msg->l1h = msgb_put(msg, sizeof(GsmL1_Prim_t));
+		memset(msg->l1h, 0, sizeof(GsmL1_Prim_t));
+	}
+
+	return msg;
+}
+
+/* get an empty msgb for a primitive read from the DSP */
+struct msgb *l1if_rx_msgb_get(struct femtol1_hdl *fl1h)
+{
+	struct msgb *msg = l1prim_pool_get(fl1h->rx_pool);
+
+	if (msg)
+		msg->l1h = msg->data;
+
+	return msg;
+}
+
 static GsmL1_PhDataReq_t *
 data_req_from_rts_ind(GsmL1_Prim_t *l1p,
 		const GsmL1_PhReadyToSendInd_t *rts_ind)
@@ -205,41 +515,60 @@ empty_req_from_rts_ind(GsmL1_Prim_t *l1p,
 	return empty_req;
 }
 
-/* obtain a ptr to the lapdm_channel for a given hLayer2 */
-static struct lapdm_channel *
-get_lapdm_chan_by_hl2(struct gsm_bts_trx *trx, uint32_t hLayer2)
-{
-	struct gsm_lchan *lchan;
-
-	lchan = l1if_hLayer2_to_lchan(trx, hLayer2);
-	if (!lchan)
-		return NULL;
-
-	return &lchan->lapdm_ch;
-}
-
 static const uint8_t fill_frame[GSM_MACBLOCK_LEN] = {
 	0x01, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
 	0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
 	0x2B, 0x2B, 0x2B
 };
 
+/* Number of voice frames between the previous TCH PH-RTS.ind of the
+ * lchan and the one for frame number fn.  Both TCH/F and each TCH/H
+ * sub-channel carry 6 voice frames of 20ms in 26 TDMA frames (120ms),
+ * so the RTS come every 4 or 5 frames.  The rounding error is carried
+ * over to the next call, so that neither the 4/4/5 cadence nor a late
+ * RTS make the RTP timestamp drift away from the frame number. */
+static unsigned int tch_rts_elapsed(struct l1_hl2_ctx *hl2, uint32_t fn)
+{
+	uint32_t fn_delta;
+	int32_t acc;
+	int frames;
+
+	if (!hl2->tch_last_fn_valid) {
+		hl2->tch_last_fn = fn;
+		hl2->tch_last_fn_valid = 1;
+		hl2->tch_fn_rem = 0;
+		return 1;
+	}
+
+	fn_delta = (fn + GSM_HYPERFRAME - hl2->tch_last_fn) % GSM_HYPERFRAME;
+	hl2->tch_last_fn = fn;
+
+	/* in 1/6 TDMA frames, rounded to the nearest voice frame */
+	acc = hl2->tch_fn_rem + fn_delta * 6;
+	frames = (acc + 13) / 26;
+	if (frames < 0)
+		frames = 0;
+	hl2->tch_fn_rem = acc - frames * 26;
+
+	return frames;
+}
+
 static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 				     GsmL1_PhReadyToSendInd_t *rts_ind)
 {
 	struct gsm_bts_trx *trx = fl1->priv;
 	struct gsm_bts *bts = trx->bts;
-	struct gsm_bts_role_bts *btsb = bts->role;
 	struct msgb *resp_msg;
 	GsmL1_PhDataReq_t *data_req;
 	GsmL1_MsgUnitParam_t *msu_param;
-	struct lapdm_channel *lc;
+	struct l1_hl2_ctx *hl2;
 	struct lapdm_entity *le;
 	struct gsm_lchan *lchan;
 	struct gsm_time g_time;
 	uint32_t t3p;
 	uint8_t *si;
 	struct osmo_phsap_prim pp;
+	uint32_t rts_us = l1_lat_now();
 	int rc;
 
 	gsm_fn2gsmtime(&g_time, rts_ind->u32Fn);
@@ -248,30 +577,35 @@ static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 		g_time.t1, g_time.t2, g_time.t3,
 		get_value_string(femtobts_l1sapi_names, rts_ind->sapi));
 
+	/* resolve the L2 entity using rts_ind->hLayer2 */
+	hl2 = l1if_hLayer2_ctx(fl1, rts_ind->hLayer2);
+
 	/* In case of TCH downlink trasnmission, we already have a l1
 	 * primitive msgb pre-allocated and pre-formatted in the
-	 * dl_tch_queue.  All we need to do is to pull it off the queue
+	 * tch_dl ring of the lchan.  All we need to do is to pull it off the queue
 	 * and transmit it */
 	switch (rts_ind->sapi) {
 	case GsmL1_Sapi_TchF:
 	case GsmL1_Sapi_TchH:
-		/* resolve the L2 entity using rts_ind->hLayer2 */
-		lchan = l1if_hLayer2_to_lchan(trx, rts_ind->hLayer2);
-		if (!lchan)
+		if (!hl2)
 			break;
+		lchan = hl2->lchan;
 
 		if (lchan->abis_ip.rtp_socket) {
 			osmo_rtp_socket_poll(lchan->abis_ip.rtp_socket);
-			/* FIXME: we _assume_ that we never miss TDMA
-			 * frames and that we always get to this point
-			 * for every to-be-transmitted voice frame.  A
-			 * better solution would be to compute
-			 * rx_user_ts based on how many TDMA frames have
-			 * elapsed since the last call */
-			lchan->abis_ip.rtp_socket->rx_user_ts += GSM_RTP_DURATION;
+			/* advance by the number of voice frames that
+			 * elapsed since the last PH-RTS.ind, so that
+			 * missed TDMA frames don't shift the playout */
+			lchan->abis_ip.rtp_socket->rx_user_ts +=
+				tch_rts_elapsed(hl2, rts_ind->u32Fn) *
+							GSM_RTP_DURATION;
+			/* get a msgb from the DL TCH ring */
+			resp_msg = tch_dl_dequeue(lchan);
+		} else {
+			/* the RTP stream is gone, drop what's left */
+			tch_dl_flush(lchan);
+			resp_msg = NULL;
 		}
-		/* get a msgb from the dl_tx_queue */
-		resp_msg = msgb_dequeue(&lchan->dl_tch_queue);
 		/* if there is none, try to generate empty TCH frame
 		 * like AMR SID_BAD */
 		if (!resp_msg) {
@@ -297,9 +631,11 @@ static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 		break;
 	}
 
-	/* in all other cases, we need to allocate a new PH-DATA.ind
-	 * primitive msgb and start to fill it */
-	resp_msg = l1p_msgb_alloc();
+	/* in all other cases, we need a new PH-DATA.req primitive msgb
+	 * from the pool and start to fill it */
+	resp_msg = l1p_msgb_get(fl1);
+	if (!resp_msg)
+		return -ENOMEM;
 	data_req = data_req_from_rts_ind(msgb_l1prim(resp_msg), rts_ind);
 	msu_param = &data_req->msgUnitParam;
 
@@ -326,9 +662,12 @@ static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 			memcpy(msu_param->u8Buffer, fill_frame, GSM_MACBLOCK_LEN);
 		break;
 	case GsmL1_Sapi_Sacch:
-		/* resolve the L2 entity using rts_ind->hLayer2 */
-		lchan = l1if_hLayer2_to_lchan(trx, rts_ind->hLayer2);
-		le = &lchan->lapdm_ch.lapdm_acch;
+		if (!hl2) {
+			memcpy(msu_param->u8Buffer, fill_frame, GSM_MACBLOCK_LEN);
+			break;
+		}
+		lchan = hl2->lchan;
+		le = &hl2->lc->lapdm_acch;
 		rc = lapdm_phsap_dequeue_prim(le, &pp);
 		if (rc < 0) {
 			/* No SACCH data from LAPDM pending, send SACCH filling */
@@ -345,9 +684,11 @@ static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 		}
 		break;
 	case GsmL1_Sapi_Sdcch:
-		/* resolve the L2 entity using rts_ind->hLayer2 */
-		lc = get_lapdm_chan_by_hl2(trx, rts_ind->hLayer2);
-		le = &lc->lapdm_dcch;
+		if (!hl2) {
+			memcpy(msu_param->u8Buffer, fill_frame, GSM_MACBLOCK_LEN);
+			break;
+		}
+		le = &hl2->lc->lapdm_dcch;
 		rc = lapdm_phsap_dequeue_prim(le, &pp);
 		if (rc < 0)
 			memcpy(msu_param->u8Buffer, fill_frame, GSM_MACBLOCK_LEN);
@@ -357,19 +698,12 @@ static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 		}
 		break;
 	case GsmL1_Sapi_Agch:
-		/* special queue of messages from IMM ASS CMD */
-		{
-			struct msgb *msg = bts_agch_dequeue(bts);
-			if (!msg)
-				memcpy(msu_param->u8Buffer, fill_frame, GSM_MACBLOCK_LEN);
-			else {
-				memcpy(msu_param->u8Buffer, msg->data, msg->len);
-				msgb_free(msg);
-			}
-		}
-		break;
 	case GsmL1_Sapi_Pch:
-		rc = paging_gen_msg(btsb->paging_state, msu_param->u8Buffer, &g_time);
+		/* special queue of messages from IMM ASS CMD, and paging */
+		rc = bts_ccch_copy_msg(bts, msu_param->u8Buffer, &g_time,
+				       rts_ind->sapi == GsmL1_Sapi_Agch);
+		if (rc < 0)
+			memcpy(msu_param->u8Buffer, fill_frame, GSM_MACBLOCK_LEN);
 		break;
 	case GsmL1_Sapi_TchF:
 	case GsmL1_Sapi_TchH:
@@ -379,9 +713,9 @@ static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 		break;
 	case GsmL1_Sapi_FacchF:
 	case GsmL1_Sapi_FacchH:
-		/* resolve the L2 entity using rts_ind->hLayer2 */
-		lc = get_lapdm_chan_by_hl2(trx, rts_ind->hLayer2);
-		le = &lc->lapdm_dcch;
+		if (!hl2)
+			goto empty_frame;
+		le = &hl2->lc->lapdm_dcch;
 		rc = lapdm_phsap_dequeue_prim(le, &pp);
 		if (rc < 0)
 			goto empty_frame;
@@ -397,7 +731,15 @@ static int handle_ph_readytosend_ind(struct femtol1_hdl *fl1,
 	}
 tx:
 	/* transmit */
-	osmo_wqueue_enqueue(&fl1->write_q[MQ_L1_WRITE], resp_msg);
+	l1_lat_enqueue(&fl1->lat, resp_msg, rts_ind->sapi, rts_us);
+	rc = osmo_wqueue_enqueue(&fl1->write_q[MQ_L1_WRITE], resp_msg);
+	if (rc < 0) {
+		LOGP(DL1C, LOGL_ERROR, "L1 write queue full, dropping "
+			"PH-DATA.req for SAPI %s\n",
+			get_value_string(femtobts_l1sapi_names, rts_ind->sapi));
+		msgb_free(resp_msg);
+		return rc;
+	}
 
 	return 0;
 
@@ -411,9 +753,15 @@ empty_frame:
 static int handle_mph_time_ind(struct femtol1_hdl *fl1,
 				GsmL1_MphTimeInd_t *time_ind)
 {
+	struct gsm_bts_trx *trx = fl1->priv;
+	struct gsm_bts_role_bts *btsb = trx->bts->role;
+
 	/* Update our data structures with the current GSM time */
 	gsm_fn2gsmtime(&fl1->gsm_time, time_ind->u32Fn);
 
+	/* expire stale paging records */
+	paging_fn_tick(btsb->paging_state, time_ind->u32Fn);
+
 	/* check if the measurement period of some lchan has ended
 	 * and pre-compute the respective measurement */
 	trx_meas_check_compute(fl1->priv, time_ind->u32Fn -1);
@@ -466,20 +814,27 @@ static int process_meas_res(struct gsm_lchan *lchan, GsmL1_MeasParam_t *m)
 static int handle_ph_data_ind(struct femtol1_hdl *fl1, GsmL1_PhDataInd_t *data_ind,
 			      struct msgb *l1p_msg)
 {
+	const struct l1_hl2_ctx *hl2;
 	struct osmo_phsap_prim pp;
 	struct gsm_lchan *lchan;
 	struct lapdm_entity *le;
 	struct msgb *msg;
 	int rc = 0;
 
-	lchan = l1if_hLayer2_to_lchan(fl1->priv, data_ind->hLayer2);
-	if (!lchan) {
+	hl2 = l1if_hLayer2_ctx(fl1, data_ind->hLayer2);
+	if (!hl2) {
 		LOGP(DL1C, LOGL_ERROR, "unable to resolve lchan by hLayer2\n");
 		return -ENODEV;
 	}
+	lchan = hl2->lchan;
 
 	process_meas_res(lchan, &data_ind->measParam);
 
+	/* bad blocks count for the AMR link adaptation as well */
+	if (data_ind->sapi == GsmL1_Sapi_TchF ||
+	    data_ind->sapi == GsmL1_Sapi_TchH)
+		l1if_tch_amr_meas(lchan, data_ind->measParam.fLinkQuality);
+
 	if (data_ind->measParam.fLinkQuality < MIN_QUAL_NORM)
 		return 0;
 
@@ -503,7 +858,7 @@ static int handle_ph_data_ind(struct femtol1_hdl *fl1, GsmL1_PhDataInd_t *data_i
 	case GsmL1_Sapi_FacchF:
 	case GsmL1_Sapi_FacchH:
 		/* SDCCH, SACCH and FACCH all go to LAPDm */
-		le = le_by_l1_sapi(&lchan->lapdm_ch, data_ind->sapi);
+		le = le_by_l1_sapi(hl2->lc, data_ind->sapi);
 		/* allocate and fill LAPDm primitive */
 		msg = msgb_alloc_headroom(128, 64, "PH-DATA.ind");
 		osmo_prim_init(&pp.oph, SAP_GSM_PH, PRIM_PH_DATA,
@@ -515,7 +870,7 @@ static int handle_ph_data_ind(struct femtol1_hdl *fl1, GsmL1_PhDataInd_t *data_i
 			data_ind->msgUnitParam.u8Size);
 
 		/* LAPDm requires those... */
-		pp.u.data.chan_nr = gsm_lchan2chan_nr(lchan);
+		pp.u.data.chan_nr = hl2->chan_nr;
 		pp.u.data.link_id = gen_link_id(data_ind->sapi, 0);
 
 		/* feed into the LAPDm code of libosmogsm */
@@ -538,8 +893,8 @@ static int handle_ph_data_ind(struct femtol1_hdl *fl1, GsmL1_PhDataInd_t *data_i
 
 static int handle_ph_ra_ind(struct femtol1_hdl *fl1, GsmL1_PhRaInd_t *ra_ind)
 {
+	const struct l1_hl2_ctx *hl2;
 	struct osmo_phsap_prim pp;
-	struct lapdm_channel *lc;
 
 	if (ra_ind->measParam.fLinkQuality < MIN_QUAL_RACH)
 		return 0;
@@ -547,8 +902,8 @@ static int handle_ph_ra_ind(struct femtol1_hdl *fl1, GsmL1_PhRaInd_t *ra_ind)
 	DEBUGP(DL1C, "Rx PH-RA.ind");
 	dump_meas_res(&ra_ind->measParam);
 
-	lc = get_lapdm_chan_by_hl2(fl1->priv, ra_ind->hLayer2);
-	if (!lc) {
+	hl2 = l1if_hLayer2_ctx(fl1, ra_ind->hLayer2);
+	if (!hl2) {
 		LOGP(DL1C, LOGL_ERROR, "unable to resolve LAPD channel by hLayer2\n");
 		return -ENODEV;
 	}
@@ -565,7 +920,7 @@ static int handle_ph_ra_ind(struct femtol1_hdl *fl1, GsmL1_PhRaInd_t *ra_ind)
 	else
 		pp.u.rach_ind.acc_delay = ra_ind->measParam.i16BurstTiming >> 2;
 
-	return lapdm_phsap_up(&pp.oph, &lc->lapdm_dcch);
+	return lapdm_phsap_up(&pp.oph, &hl2->lc->lapdm_dcch);
 }
 
 /* handle any random indication from the L1 */
@@ -602,12 +957,43 @@ static int l1if_handle_ind(struct femtol1_hdl *fl1, struct msgb *msg)
 	return rc;
 }
 
-int l1if_handle_l1prim(struct femtol1_hdl *fl1h, struct msgb *msg)
+/* complete the oldest of the requests waiting for the confirmation
+ * in msg.  The L1 confirms requests of one kind in order, so several
+ * of them can be outstanding at the same time.  If the confirmation
+ * names timeslot and SAPI, it completes the oldest request for them,
+ * and one without any request, like a duplicate after a resend, is
+ * dropped. */
+static int wlc_complete(struct llist_head *wlc_list, struct msgb *msg,
+			const GsmL1_Prim_t *l1p)
 {
-	GsmL1_Prim_t *l1p = msgb_l1prim(msg);
 	struct wait_l1_conf *wlc;
 	int rc;
 
+	if (l1p) {
+		llist_for_each_entry(wlc, wlc_list, list) {
+			if (wlc_conf_matches(wlc, l1p))
+				goto found;
+		}
+		LOGP(DL1C, LOGL_NOTICE, "No request waiting for this %s, "
+			"dropping\n", get_value_string(femtobts_l1prim_names,
+							l1p->id));
+		msgb_free(msg);
+		return 0;
+	}
+
+	wlc = llist_entry(wlc_list->next, struct wait_l1_conf, list);
+found:
+	llist_del(&wlc->list);
+	rc = wlc->cb(msg, wlc->cb_data);
+	release_wlc(wlc);
+
+	return rc;
+}
+
+int l1if_handle_l1prim(struct femtol1_hdl *fl1h, struct msgb *msg)
+{
+	GsmL1_Prim_t *l1p = msgb_l1prim(msg);
+
 	switch (l1p->id) {
 	case GsmL1_PrimId_MphTimeInd:
 		/* silent, don't clog the log file */
@@ -617,17 +1003,10 @@ int l1if_handle_l1prim(struct femtol1_hdl *fl1h, struct msgb *msg)
 			get_value_string(femtobts_l1prim_names, l1p->id));
 	}
 
-	/* check if this is a resposne to a sync-waiting request */
-	llist_for_each_entry(wlc, &fl1h->wlc_list, list) {
-		/* the limitation here is that we cannot have multiple callers
-		 * sending the same primitive */
-		if (wlc->is_sys_prim == 0 && l1p->id == wlc->conf_prim_id) {
-			llist_del(&wlc->list);
-			rc = wlc->cb(msg, wlc->cb_data);
-			release_wlc(wlc);
-			return rc;
-		}
-	}
+	/* check if this is a response to a sync-waiting request */
+	if (l1p->id < GsmL1_PrimId_NUM &&
+	    !llist_empty(&fl1h->wlc_l1[l1p->id]))
+		return wlc_complete(&fl1h->wlc_l1[l1p->id], msg, l1p);
 
 	/* if we reach here, it is not a Conf for a pending Req */
 	return l1if_handle_ind(fl1h, msg);
@@ -636,23 +1015,14 @@ int l1if_handle_l1prim(struct femtol1_hdl *fl1h, struct msgb *msg)
 int l1if_handle_sysprim(struct femtol1_hdl *fl1h, struct msgb *msg)
 {
 	FemtoBts_Prim_t *sysp = msgb_sysprim(msg);
-	struct wait_l1_conf *wlc;
-	int rc;
 
 	LOGP(DL1P, LOGL_DEBUG, "Rx SYS prim %s\n",
 		get_value_string(femtobts_sysprim_names, sysp->id));
 
-	/* check if this is a resposne to a sync-waiting request */
-	llist_for_each_entry(wlc, &fl1h->wlc_list, list) {
-		/* the limitation here is that we cannot have multiple callers
-		 * sending the same primitive */
-		if (wlc->is_sys_prim && sysp->id == wlc->conf_prim_id) {
-			llist_del(&wlc->list);
-			rc = wlc->cb(msg, wlc->cb_data);
-			release_wlc(wlc);
-			return rc;
-		}
-	}
+	/* check if this is a response to a sync-waiting request */
+	if (sysp->id < FemtoBts_PrimId_NUM &&
+	    !llist_empty(&fl1h->wlc_sys[sysp->id]))
+		return wlc_complete(&fl1h->wlc_sys[sysp->id], msg, NULL);
 	/* if we reach here, it is not a Conf for a pending Req */
 	return l1if_handle_ind(fl1h, msg);
 }
@@ -693,6 +1063,18 @@ static int activate_rf_compl_cb(struct msgb *resp, void *data)
 	LOGP(DL1C, LOGL_INFO, "Rx RF-%sACT.conf (status=%s)\n", on ? "" : "DE",
 		get_value_string(femtobts_l1status_names, status));
 
+	talloc_free(resp);
+
+	/* after a reset to recover the L1, the BSC is not involved */
+	if (on && fl1h->recovery.state != L1_RCV_NONE) {
+		if (status != GsmL1_Status_Success) {
+			l1if_recover(fl1h, "RF-ACT failure");
+			return 0;
+		}
+		fl1h->recovery.state = L1_RCV_RESTORE;
+		trx_l1_restore(trx);
+		return 0;
+	}
 
 	if (on) {
 		if (status != GsmL1_Status_Success) {
@@ -713,8 +1095,6 @@ static int activate_rf_compl_cb(struct msgb *resp, void *data)
 		oml_mo_state_chg(&trx->bb_transc.mo, NM_OPSTATE_DISABLED, NM_AVSTATE_OFF_LINE);
 	}
 
-	talloc_free(resp);
-
 	return 0;
 }
 
@@ -796,6 +1176,11 @@ static int reset_compl_cb(struct msgb *resp, void *data)
 	talloc_free(resp);
 
 	/* If we're coming out of reset .. */
+	if (status != GsmL1_Status_Success &&
+	    fl1h->recovery.state != L1_RCV_NONE) {
+		l1if_recover(fl1h, "L1-RESET failure");
+		return 0;
+	}
 	if (status != GsmL1_Status_Success) {
 		LOGP(DL1C, LOGL_FATAL, "L1-RESET.conf with status %s\n",
 			get_value_string(femtobts_l1status_names, status));
@@ -815,6 +1200,42 @@ static int reset_compl_cb(struct msgb *resp, void *data)
 	return 0;
 }
 
+/* Reset the L1 after it stopped responding, and bring the TRX back to
+ * the state it had: the L1 is reset, the RF activated, the TRX and its
+ * timeslots initialized and all lchans activated again.  Only if that
+ * fails L1_RECOVERY_MAX times in a row, we give up and exit, so that
+ * we are re-spawned. */
+void l1if_recover(struct femtol1_hdl *fl1h, const char *reason)
+{
+	if (++fl1h->recovery.attempts > L1_RECOVERY_MAX) {
+		LOGP(DL1C, LOGL_FATAL, "%s, L1 did not recover after %u "
+			"resets, giving up\n", reason, L1_RECOVERY_MAX);
+		exit(23);
+	}
+
+	LOGP(DL1C, LOGL_ERROR, "%s, resetting the L1 (attempt %u)\n",
+		reason, fl1h->recovery.attempts);
+
+	osmo_timer_del(&fl1h->alive_timer);
+	osmo_wqueue_clear(&fl1h->write_q[MQ_L1_WRITE]);
+	osmo_wqueue_clear(&fl1h->write_q[MQ_SYS_WRITE]);
+
+	/* the call-backs of the failed requests see that we recover */
+	fl1h->recovery.state = L1_RCV_RESET;
+	flush_wlc(fl1h);
+	l1if_reset(fl1h);
+}
+
+/* called once the state of the TRX has been restored in the L1 */
+void l1if_recovery_done(struct femtol1_hdl *fl1h)
+{
+	LOGP(DL1C, LOGL_NOTICE, "L1 has been recovered\n");
+
+	fl1h->recovery.state = L1_RCV_NONE;
+	fl1h->recovery.attempts = 0;
+	fl1h->recovery.count++;
+}
+
 int l1if_reset(struct femtol1_hdl *hdl)
 {
 	struct msgb *msg = sysp_msgb_alloc();
@@ -845,23 +1266,42 @@ int l1if_set_trace_flags(struct femtol1_hdl *hdl, uint32_t flags)
 struct femtol1_hdl *l1if_open(void *priv)
 {
 	struct femtol1_hdl *fl1h;
+	unsigned int i;
 	int rc;
 
 	fl1h = talloc_zero(priv, struct femtol1_hdl);
 	if (!fl1h)
 		return NULL;
-	INIT_LLIST_HEAD(&fl1h->wlc_list);
+	for (i = 0; i < ARRAY_SIZE(fl1h->wlc_l1); i++)
+		INIT_LLIST_HEAD(&fl1h->wlc_l1[i]);
+	for (i = 0; i < ARRAY_SIZE(fl1h->wlc_sys); i++)
+		INIT_LLIST_HEAD(&fl1h->wlc_sys[i]);
 
 	fl1h->priv = priv;
 	fl1h->clk_cal = 0xffff;
 
+	fl1h->tx_pool = l1prim_pool_alloc(tall_bts_ctx, sizeof(GsmL1_Prim_t),
+					  L1PRIM_POOL_TX_SIZE);
+	fl1h->rx_pool = l1prim_pool_alloc(tall_bts_ctx,
+					  OSMO_MAX(sizeof(GsmL1_Prim_t),
+						   sizeof(FemtoBts_Prim_t)),
+					  L1PRIM_POOL_RX_SIZE);
+	if (!fl1h->tx_pool || !fl1h->rx_pool)
+		goto out_free;
+
 	rc = l1if_transport_open(fl1h);
-	if (rc < 0) {
-		talloc_free(fl1h);
-		return NULL;
-	}
+	if (rc < 0)
+		goto out_free;
 
 	return fl1h;
+
+out_free:
+	if (fl1h->tx_pool)
+		l1prim_pool_release(fl1h->tx_pool);
+	if (fl1h->rx_pool)
+		l1prim_pool_release(fl1h->rx_pool);
+	talloc_free(fl1h);
+	return NULL;
 }
 
 int l1if_close(struct femtol1_hdl *fl1h)
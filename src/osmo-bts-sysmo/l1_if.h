@@ -5,6 +5,8 @@
 #include <osmocom/core/write_queue.h>
 #include <osmocom/gsm/gsm_utils.h>
 
+#include "l1_latency.h"
+
 enum {
 	MQ_SYS_READ,
 	MQ_L1_READ,
@@ -17,12 +19,103 @@ enum {
 	_NUM_MQ_WRITE
 };
 
+/* A pool of preallocated msgbs for L1 primitives.  Freeing a msgb
+ * taken from the pool puts it back, so the per TDMA frame primitives
+ * do not need talloc at all once the pool has been filled.  The pool
+ * is a talloc object of its own, as it has to stay around until the
+ * last of its msgbs comes back. */
+struct l1prim_pool {
+	struct llist_head free_list;
+	unsigned int msg_size;		/* room for the primitive */
+	unsigned int size;		/* msgbs owned by the pool */
+	unsigned int num_free;		/* ... of which are unused */
+	int released;			/* see l1prim_pool_release() */
+	struct {
+		unsigned int get;	/* msgbs taken from the pool */
+		unsigned int alloc;	/* pool empty, msgb allocated */
+	} stats;
+};
+
+#define L1PRIM_POOL_TX_SIZE	32
+#define L1PRIM_POOL_RX_SIZE	8
+
+/* an lchan activation in progress, see lchan_activate() */
+struct lchan_act_state {
+	uint8_t sapis_pending;	/* MPH-ACTIVATE.req without .conf */
+	uint8_t failed;		/* ... one of them was not successful */
+	uint8_t ack_rsl;	/* answer RSL CHAN ACT once all are done */
+	uint8_t gen;		/* activation the .conf has to belong to */
+	uint8_t sapis_active;	/* confirmed, by index in the SAPI list */
+	uint8_t restore;	/* re-activation after a L1 reset */
+};
+
+/* What an hLayer2 handle refers to.  The handle is chosen such that
+ * its low bits are the index into femtol1_hdl.hl2_ctx[], see
+ * l1if_lchan_to_hLayer2(). */
+struct l1_hl2_ctx {
+	uint32_t hLayer2;
+	struct gsm_lchan *lchan;	/* NULL unless registered */
+	struct lapdm_channel *lc;
+	uint8_t chan_nr;		/* RSL channel number */
+	/* frame number of the last TCH PH-RTS.ind */
+	uint32_t tch_last_fn;
+	int32_t tch_fn_rem;		/* rounding error, 1/6 frames */
+	uint8_t tch_last_fn_valid;
+};
+
+/* 8 timeslots of up to 8 lchans each */
+#define L1_HL2_NUM	64
+
+/* Downlink TCH frames of an lchan, waiting for their PH-RTS.ind.  How
+ * many of them we keep follows the jitter of the RTP arrival, see
+ * tch_dl_enqueue(). */
+#define TCH_DL_RING_SIZE	8
+#define TCH_DL_TARGET_MAX	6
+
+struct tch_dl_ring {
+	struct msgb *msg[TCH_DL_RING_SIZE];
+	unsigned int head;		/* index of the oldest frame */
+	unsigned int depth;		/* number of frames queued */
+	unsigned int target;		/* maximum depth at the moment */
+	uint32_t jitter;		/* RTP arrival jitter, us * 16 */
+	uint32_t last_rx_us;
+	uint8_t last_rx_valid;
+	struct {
+		unsigned int enqueued;
+		unsigned int dropped;	/* to keep the depth at target */
+		unsigned int underruns;	/* PH-RTS.ind without a frame */
+	} stats;
+};
+
+/* AMR codec modes of an lchan, as index into lchan->tch.amr_mr */
+struct amr_lchan_state {
+	uint8_t ul_cmi;		/* used by the MS in the uplink */
+	uint8_t ul_cmr;		/* requested by the MS for the downlink */
+	uint8_t ul_cmr_valid;
+	uint8_t ul_cmc;		/* commanded to the MS for the uplink */
+	uint8_t dl_cmi;		/* sent by us in the downlink */
+	uint8_t dl_cmr;		/* requested by the RTP peer for the uplink */
+	uint8_t dl_cmr_valid;
+	float ul_ci;		/* averaged uplink C/I in dB */
+	uint8_t ul_ci_valid;
+};
+
+/* recovery of the L1 after it stopped responding, see l1if_recover() */
+enum l1if_recovery_state {
+	L1_RCV_NONE,		/* normal operation */
+	L1_RCV_RESET,		/* L1 reset and RF activation */
+	L1_RCV_RESTORE,		/* restoring the TRX, TS and lchans */
+};
+
 struct femtol1_hdl {
 	struct gsm_time gsm_time;
 	uint32_t hLayer1;			/* handle to the L1 instance in the DSP */
 	uint32_t dsp_trace_f;
 	uint16_t clk_cal;
-	struct llist_head wlc_list;
+	/* requests waiting for their confirmation, in the order they
+	 * were sent, by the id of the expected confirmation */
+	struct llist_head wlc_l1[GsmL1_PrimId_NUM];
+	struct llist_head wlc_sys[FemtoBts_PrimId_NUM];
 
 	void *priv;			/* user reference */
 
@@ -32,6 +125,27 @@ struct femtol1_hdl {
 	struct osmo_fd read_ofd[_NUM_MQ_READ];	/* osmo file descriptors */
 	struct osmo_wqueue write_q[_NUM_MQ_WRITE];
 
+	struct l1prim_pool *tx_pool;	/* PH-DATA.req and friends */
+	struct l1prim_pool *rx_pool;	/* primitives read from the DSP */
+
+	struct l1_lat_stats lat;	/* PH-RTS.ind to PH-DATA.req write */
+
+	/* lchans of activated SAPIs, by hLayer2 */
+	struct l1_hl2_ctx hl2_ctx[L1_HL2_NUM];
+
+	/* by timeslot and lchan number (TRX_NR_TS, TS_MAX_LCHAN) */
+	struct lchan_act_state act_state[8][8];
+	struct tch_dl_ring tch_dl[8][8];
+	struct amr_lchan_state amr[8][8];
+
+	struct {
+		enum l1if_recovery_state state;
+		unsigned int attempts;	/* resets since the last success */
+		unsigned int pending;	/* MPH-CONNECT.req, then lchans of
+					 * the restore */
+		unsigned int count;	/* successful recoveries */
+	} recovery;
+
 	struct {
 		uint8_t dsp_version[3];
 		uint8_t fpga_version[3];
@@ -51,18 +165,42 @@ int l1if_req_compl(struct femtol1_hdl *fl1h, struct msgb *msg,
 struct femtol1_hdl *l1if_open(void *priv);
 int l1if_close(struct femtol1_hdl *hdl);
 int l1if_reset(struct femtol1_hdl *hdl);
+void l1if_recover(struct femtol1_hdl *fl1h, const char *reason);
+void l1if_recovery_done(struct femtol1_hdl *fl1h);
 int l1if_activate_rf(struct femtol1_hdl *hdl, int on);
 int l1if_set_trace_flags(struct femtol1_hdl *hdl, uint32_t flags);
 
 struct msgb *l1p_msgb_alloc(void);
 struct msgb *sysp_msgb_alloc(void);
+struct msgb *l1p_msgb_get(struct femtol1_hdl *fl1h);
 
 uint32_t l1if_lchan_to_hLayer2(struct gsm_lchan *lchan);
 struct gsm_lchan *l1if_hLayer2_to_lchan(struct gsm_bts_trx *trx, uint32_t hLayer2);
+void l1if_hLayer2_register(struct femtol1_hdl *fl1h, struct gsm_lchan *lchan);
+void l1if_hLayer2_unregister(struct femtol1_hdl *fl1h, struct gsm_lchan *lchan);
+
+/* resolve an hLayer2 handle, NULL if no lchan is registered for it */
+static inline struct l1_hl2_ctx *
+l1if_hLayer2_ctx(struct femtol1_hdl *fl1h, uint32_t hLayer2)
+{
+	struct l1_hl2_ctx *ctx = &fl1h->hl2_ctx[hLayer2 % L1_HL2_NUM];
+
+	if (!ctx->lchan || ctx->hLayer2 != hLayer2)
+		return NULL;
+
+	return ctx;
+}
+
+/* oml.c */
+int trx_l1_restore(struct gsm_bts_trx *trx);
 
 /* tch.c */
 int l1if_tch_rx(struct gsm_lchan *lchan, struct msgb *l1p_msg);
 int l1if_tch_fill(struct gsm_lchan *lchan, uint8_t *l1_buffer);
 struct msgb *gen_empty_tch_msg(struct gsm_lchan *lchan);
+struct msgb *tch_dl_dequeue(struct gsm_lchan *lchan);
+void tch_dl_flush(struct gsm_lchan *lchan);
+void l1if_tch_amr_reset(struct gsm_lchan *lchan);
+void l1if_tch_amr_meas(struct gsm_lchan *lchan, float ci_db);
 
 #endif /* _FEMTO_L1_H */
@@ -0,0 +1,142 @@
+/* Latency histograms of the answers to L1 PH-RTS.ind */
+
+/* (C) 2026 by agent <agent@local>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/utils.h>
+
+#include "gsmL1prim.h"
+#include "l1_latency.h"
+
+/* time stamps of a PH-DATA.req kept in msg->cb[], which msgb_alloc()
+ * and the primitive pool hand out zeroed */
+#define CB_SAPI		0	/* SAPI + 1, 0 if the msgb is not timed */
+#define CB_RTS		1	/* arrival of the PH-RTS.ind */
+#define CB_ENQ		2	/* osmo_wqueue_enqueue() */
+
+const struct value_string l1_lat_interval_names[_NUM_L1_LAT+1] = {
+	{ L1_LAT_RTS_ENQ,	"RTS-enqueue" },
+	{ L1_LAT_ENQ_WRITE,	"enqueue-write" },
+	{ L1_LAT_RTS_WRITE,	"RTS-write" },
+	{ 0, NULL }
+};
+
+/* monotonic time in microseconds, wrapping after 71 minutes */
+uint32_t l1_lat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int bucket_idx(uint32_t us)
+{
+	unsigned int msb, mag;
+
+	if (us < (1 << L1_LAT_SUB_BITS))
+		return us;
+
+	msb = 31 - __builtin_clz(us);
+	if (msb > L1_LAT_MAX_MSB)
+		return L1_LAT_NUM_BUCKETS - 1;
+
+	mag = msb - L1_LAT_SUB_BITS + 1;
+	return (mag << L1_LAT_SUB_BITS) |
+		((us >> (msb - L1_LAT_SUB_BITS)) & ((1 << L1_LAT_SUB_BITS) - 1));
+}
+
+/* the highest latency that ends up in bucket idx */
+static uint32_t bucket_max(unsigned int idx)
+{
+	unsigned int mag = idx >> L1_LAT_SUB_BITS;
+	unsigned int sub = idx & ((1 << L1_LAT_SUB_BITS) - 1);
+
+	if (mag == 0)
+		return sub;
+
+	return (((1 << L1_LAT_SUB_BITS) + sub + 1) << (mag - 1)) - 1;
+}
+
+void l1_lat_hist_add(struct l1_lat_hist *h, uint32_t us)
+{
+	h->buckets[bucket_idx(us)]++;
+	h->count++;
+	h->sum += us;
+	if (us > h->max)
+		h->max = us;
+}
+
+/* latency below which permille/1000 of all samples are */
+uint32_t l1_lat_hist_percentile(const struct l1_lat_hist *h,
+				unsigned int permille)
+{
+	uint64_t target, sum = 0;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	target = ((uint64_t) h->count * permille + 999) / 1000;
+	if (!target)
+		target = 1;
+
+	for (i = 0; i < L1_LAT_NUM_BUCKETS; i++) {
+		sum += h->buckets[i];
+		if (sum >= target)
+			return OSMO_MIN(bucket_max(i), h->max);
+	}
+
+	return h->max;
+}
+
+void l1_lat_enqueue(struct l1_lat_stats *ls, struct msgb *msg,
+		    GsmL1_Sapi_t sapi, uint32_t rts_us)
+{
+	uint32_t now = l1_lat_now();
+
+	if (sapi >= GsmL1_Sapi_NUM)
+		return;
+
+	msg->cb[CB_SAPI] = sapi + 1;
+	msg->cb[CB_RTS] = rts_us;
+	msg->cb[CB_ENQ] = now;
+
+	l1_lat_hist_add(&ls->hist[sapi][L1_LAT_RTS_ENQ], now - rts_us);
+}
+
+void l1_lat_written(struct l1_lat_stats *ls, struct msgb *msg)
+{
+	struct l1_lat_hist *hist;
+	uint32_t now;
+
+	if (!msg->cb[CB_SAPI])
+		return;
+
+	now = l1_lat_now();
+	hist = ls->hist[msg->cb[CB_SAPI] - 1];
+
+	l1_lat_hist_add(&hist[L1_LAT_ENQ_WRITE], now - (uint32_t) msg->cb[CB_ENQ]);
+	l1_lat_hist_add(&hist[L1_LAT_RTS_WRITE], now - (uint32_t) msg->cb[CB_RTS]);
+}
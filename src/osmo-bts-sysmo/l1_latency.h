@@ -0,0 +1,54 @@
+#ifndef _L1_LATENCY_H
+#define _L1_LATENCY_H
+
+#include <stdint.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/utils.h>
+
+#include "gsmL1prim.h"
+
+/* the intervals measured for every answer to a PH-RTS.ind */
+enum l1_lat_interval {
+	L1_LAT_RTS_ENQ,		/* PH-RTS.ind until osmo_wqueue_enqueue() */
+	L1_LAT_ENQ_WRITE,	/* osmo_wqueue_enqueue() until write() */
+	L1_LAT_RTS_WRITE,	/* PH-RTS.ind until write() */
+	_NUM_L1_LAT
+};
+
+/* A log-linear histogram of latencies in microseconds, in the style of
+ * HdrHistogram: every power of two is split into 2^L1_LAT_SUB_BITS
+ * buckets of equal width, so the error of a percentile is less than
+ * 1/2^L1_LAT_SUB_BITS of its value.  Latencies of 2^(L1_LAT_MAX_MSB+1)
+ * and more end up in the last bucket. */
+#define L1_LAT_SUB_BITS		3
+#define L1_LAT_MAX_MSB		20
+#define L1_LAT_NUM_BUCKETS	((L1_LAT_MAX_MSB - L1_LAT_SUB_BITS + 2) \
+							<< L1_LAT_SUB_BITS)
+
+struct l1_lat_hist {
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t buckets[L1_LAT_NUM_BUCKETS];
+};
+
+struct l1_lat_stats {
+	struct l1_lat_hist hist[GsmL1_Sapi_NUM][_NUM_L1_LAT];
+};
+
+extern const struct value_string l1_lat_interval_names[_NUM_L1_LAT+1];
+
+uint32_t l1_lat_now(void);
+void l1_lat_hist_add(struct l1_lat_hist *h, uint32_t us);
+uint32_t l1_lat_hist_percentile(const struct l1_lat_hist *h,
+				unsigned int permille);
+
+/* time stamp a msgb answering the PH-RTS.ind for sapi that arrived at
+ * rts_us, right before it is enqueued */
+void l1_lat_enqueue(struct l1_lat_stats *ls, struct msgb *msg,
+		    GsmL1_Sapi_t sapi, uint32_t rts_us);
+/* account a msgb that has just been written to the L1 */
+void l1_lat_written(struct l1_lat_stats *ls, struct msgb *msg);
+
+#endif /* _L1_LATENCY_H */
@@ -6,6 +6,7 @@
 /* functions a transport calls on arrival of primitive from BTS */
 int l1if_handle_l1prim(struct femtol1_hdl *fl1h, struct msgb *msg);
 int l1if_handle_sysprim(struct femtol1_hdl *fl1h, struct msgb *msg);
+struct msgb *l1if_rx_msgb_get(struct femtol1_hdl *fl1h);
 
 /* functions exported by a transport */
 int l1if_transport_open(struct femtol1_hdl *fl1h);
@@ -91,8 +91,15 @@ static int fwd_read_cb(struct osmo_fd *ofd)
 
 static int prim_write_cb(struct osmo_fd *ofd, struct msgb *msg)
 {
+	struct femtol1_hdl *fl1h = ofd->data;
+	int rc;
+
 	/* write to the fd */
-	return write(ofd->fd, msg->head, msg->len);
+	rc = write(ofd->fd, msg->head, msg->len);
+	if (rc == msg->len)
+		l1_lat_written(&fl1h->lat, msg);
+
+	return rc;
 }
 
 int l1if_transport_open(struct femtol1_hdl *fl1h)
@@ -123,10 +130,8 @@ int l1if_transport_open(struct femtol1_hdl *fl1h)
 		rc = osmo_sock_init_ofd(ofd, AF_UNSPEC, SOCK_DGRAM, IPPROTO_UDP,
 					bts_host, fwd_udp_ports[i],
 					OSMO_SOCK_F_CONNECT);
-		if (rc < 0) {
-			talloc_free(fl1h);
+		if (rc < 0)
 			return rc;
-		}
 	}
 
 	return 0;
@@ -63,51 +63,94 @@ static const char *wr_devnames[] = {
 	[MQ_L1_WRITE]	= DEV_L1_ARM2DSP_NAME,
 };
 
-/* callback when there's something to read from the l1 msg_queue */
-static int l1if_fd_cb(struct osmo_fd *ofd, unsigned int what)
+/* maximum number of primitives read or written per select() wakeup,
+ * so that neither direction can starve the other */
+#define MQ_BATCH_MAX	16
+
+/* read one primitive from the l1 msg_queue and dispatch it */
+static int l1if_read_prim(struct osmo_fd *ofd)
 {
-	//struct msgb *msg = l1p_msgb_alloc();
-	struct msgb *msg = msgb_alloc_headroom(2048, 128, "1l_fd");
 	struct femtol1_hdl *fl1h = ofd->data;
+	struct msgb *msg = l1if_rx_msgb_get(fl1h);
 	int rc;
 
-	msg->l1h = msg->data;
+	if (!msg)
+		return -ENOMEM;
+
 	if(ofd->priv_nr == MQ_L1_WRITE)
 		rc = read(ofd->fd, msg->l1h, sizeof(GsmL1_Prim_t));
 	else
 		rc = read(ofd->fd, msg->l1h, sizeof(FemtoBts_Prim_t));
 
 	if (rc < 0) {
-		if (rc != -1) 
+		if (errno != EAGAIN)
 			LOGP(DL1C, LOGL_ERROR, "error reading from L1 msg_queue: %s\n",
 				strerror(errno));
+		else
+			rc = -EAGAIN;
 		msgb_free(msg);
 		return rc;
 	}
 	msgb_put(msg, rc);
 
 	if (ofd->priv_nr == MQ_L1_WRITE)
-		return l1if_handle_l1prim(fl1h, msg);
+		l1if_handle_l1prim(fl1h, msg);
 	else
-		return l1if_handle_sysprim(fl1h, msg);
-};
+		l1if_handle_sysprim(fl1h, msg);
+
+	return 0;
+}
 
-/* callback when we can write to one of the l1 msg_queue devices */
-static int l1fd_write_cb(struct osmo_fd *ofd, struct msgb *msg)
+/* callback when there's something to read from the l1 msg_queue.  The
+ * fd is non-blocking, so everything the DSP has queued is drained in one
+ * go, instead of one primitive per trip through the select loop. */
+static int l1if_fd_cb(struct osmo_fd *ofd, unsigned int what)
 {
-	int rc;
+	int i, rc;
 
-	rc = write(ofd->fd, msg->l1h, msgb_l1len(msg));
-	if (rc < 0) {
-		LOGP(DL1C, LOGL_ERROR, "error writing to L1 msg_queue: %s\n",
-			strerror(errno));
-		return rc;
-	} else if (rc < msg->len) {
-		LOGP(DL1C, LOGL_ERROR, "short write to L1 msg_queue: "
-			"%u < %u\n", rc, msg->len);
-		return -EIO;
+	for (i = 0; i < MQ_BATCH_MAX; i++) {
+		rc = l1if_read_prim(ofd);
+		if (rc < 0)
+			break;
+	}
+
+	return 0;
+}
+
+/* callback when we can write to one of the l1 msg_queue devices.  This
+ * replaces osmo_wqueue_bfd_cb(), which writes a single message per
+ * wakeup, and writes until the queue is empty or the device is full. */
+static int l1fd_write_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct osmo_wqueue *wq = container_of(ofd, struct osmo_wqueue, bfd);
+	struct femtol1_hdl *fl1h = ofd->data;
+	struct msgb *msg;
+	int i, rc;
+
+	for (i = 0; i < MQ_BATCH_MAX && !llist_empty(&wq->msg_queue); i++) {
+		msg = llist_entry(wq->msg_queue.next, struct msgb, list);
+
+		rc = write(ofd->fd, msg->l1h, msgb_l1len(msg));
+		if (rc < 0 && errno == EAGAIN)
+			break;
+
+		llist_del(&msg->list);
+		wq->current_length--;
+
+		if (rc < 0) {
+			LOGP(DL1C, LOGL_ERROR, "error writing to L1 msg_queue: %s\n",
+				strerror(errno));
+		} else if (rc < msgb_l1len(msg)) {
+			LOGP(DL1C, LOGL_ERROR, "short write to L1 msg_queue: "
+				"%u < %u\n", rc, msgb_l1len(msg));
+		} else
+			l1_lat_written(&fl1h->lat, msg);
+		msgb_free(msg);
 	}
 
+	if (llist_empty(&wq->msg_queue))
+		ofd->when &= ~BSC_FD_WRITE;
+
 	return 0;
 }
 
@@ -119,7 +162,7 @@ int l1if_transport_open(struct femtol1_hdl *hdl)
 	for (i = 0; i < ARRAY_SIZE(hdl->read_ofd); i++) {
 		struct osmo_fd *ofd = &hdl->read_ofd[i];
 
-		rc = open(rd_devnames[i], O_RDONLY);
+		rc = open(rd_devnames[i], O_RDONLY | O_NONBLOCK);
 		if (rc < 0) {
 			LOGP(DL1C, LOGL_FATAL, "unable to open msg_queue %s: %s\n",
 				rd_devnames[i], strerror(errno));
@@ -141,7 +184,7 @@ int l1if_transport_open(struct femtol1_hdl *hdl)
 		struct osmo_wqueue *wq = &hdl->write_q[i];
 		struct osmo_fd *ofd = &hdl->write_q[i].bfd;
 
-		rc = open(wr_devnames[i], O_WRONLY);
+		rc = open(wr_devnames[i], O_WRONLY | O_NONBLOCK);
 		if (rc < 0) {
 			LOGP(DL1C, LOGL_FATAL, "unable to open msg_queue %s: %s\n",
 				rd_devnames[i], strerror(errno));
@@ -149,12 +192,12 @@ int l1if_transport_open(struct femtol1_hdl *hdl)
 		}
 
 		osmo_wqueue_init(wq, 10);
-		wq->write_cb = l1fd_write_cb;
 
 		ofd->fd = rc;
 		ofd->priv_nr = i;
 		ofd->data = hdl;
-		ofd->when = BSC_FD_WRITE;
+		ofd->cb = l1fd_write_cb;
+		ofd->when = 0;
 		rc = osmo_fd_register(ofd);
 		if (rc < 0) {
 			close(ofd->fd);
@@ -171,7 +214,6 @@ out_read:
 		osmo_fd_unregister(&hdl->read_ofd[i]);
 	}
 out_free:
-	talloc_free(hdl);
 	return rc;
 }
 
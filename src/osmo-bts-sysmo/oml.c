@@ -19,6 +19,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/utils.h>
@@ -34,6 +35,7 @@
 #include <osmo-bts/rsl.h>
 #include <osmo-bts/amr.h>
 #include <osmo-bts/bts.h>
+#include <osmo-bts/bts_model.h>
 
 #include "l1_if.h"
 #include "femtobts.h"
@@ -178,6 +180,7 @@ static int compl_cb_send_oml_msg(struct msgb *l1_msg, void *data)
 #endif
 
 int lchan_activate(struct gsm_lchan *lchan);
+static struct lchan_act_state *lchan_act_state(struct gsm_lchan *lchan);
 
 static int opstart_compl_cb(struct msgb *l1_msg, void *data)
 {
@@ -223,7 +226,9 @@ static int trx_init_compl_cb(struct msgb *l1_msg, void *data)
 	if (ic->status != GsmL1_Status_Success) {
 		LOGP(DL1C, LOGL_FATAL, "Rx MPH-INIT.conf status=%s\n",
 			get_value_string(femtobts_l1status_names, ic->status));
-		bts_shutdown(trx->bts, "MPH-INIT failure");
+		/* a request failed by l1if_recover() is only NACKed */
+		if (fl1h->recovery.state == L1_RCV_NONE)
+			bts_shutdown(trx->bts, "MPH-INIT failure");
 	}
 
 	fl1h->hLayer1 = ic->hLayer1;
@@ -248,8 +253,8 @@ int gsm_abis_mo_check_attr(const struct gsm_abis_mo *mo, const uint8_t *attr_ids
 
 static const uint8_t trx_rqd_attr[] = { NM_ATT_RF_MAXPOWR_R };
 
-/* initialize the layer1 */
-static int trx_init(struct gsm_bts_trx *trx)
+/* send MPH-INIT.req for the TRX */
+static int trx_mph_init(struct gsm_bts_trx *trx, l1if_compl_cb *cb)
 {
 	struct femtol1_hdl *fl1h = trx_femtol1_hdl(trx);
 	struct msgb *msg;
@@ -258,14 +263,6 @@ static int trx_init(struct gsm_bts_trx *trx)
 	enum gsm_band osmo_band;
 	int femto_band;
 
-	if (!gsm_abis_mo_check_attr(&trx->mo, trx_rqd_attr,
-				    ARRAY_SIZE(trx_rqd_attr))) {
-		/* HACK: spec says we need to decline, but openbsc
-		 * doesn't deal with this very well */
-		return oml_mo_opstart_ack(&trx->mo);
-		//return oml_mo_opstart_nack(&trx->mo, NM_NACK_CANT_PERFORM);
-	}
-
 	osmo_band = gsm_arfcn2band(trx->arfcn);
 	femto_band = band_osmo2femto(osmo_band);
 	if (femto_band < 0) {
@@ -289,10 +286,26 @@ static int trx_init(struct gsm_bts_trx *trx)
 		dev_par->fRxPowerLevel, dev_par->fTxPowerLevel);
 	
 	/* send MPH-INIT-REQ, wait for MPH-INIT-CNF */
-	return l1if_req_compl(fl1h, msg, 0, trx_init_compl_cb, fl1h);
+	return l1if_req_compl(fl1h, msg, 0, cb, fl1h);
 }
 
-static int ts_connect(struct gsm_bts_trx_ts *ts)
+/* initialize the layer1 */
+static int trx_init(struct gsm_bts_trx *trx)
+{
+	if (!gsm_abis_mo_check_attr(&trx->mo, trx_rqd_attr,
+				    ARRAY_SIZE(trx_rqd_attr))) {
+		/* HACK: spec says we need to decline, but openbsc
+		 * doesn't deal with this very well */
+		return oml_mo_opstart_ack(&trx->mo);
+		//return oml_mo_opstart_nack(&trx->mo, NM_NACK_CANT_PERFORM);
+	}
+
+	return trx_mph_init(trx, trx_init_compl_cb);
+}
+
+/* send MPH-CONNECT.req for the timeslot */
+static int ts_mph_connect(struct gsm_bts_trx_ts *ts, l1if_compl_cb *cb,
+			  void *data)
 {
 	struct msgb *msg = l1p_msgb_alloc();
 	struct femtol1_hdl *fl1h = trx_femtol1_hdl(ts->trx);
@@ -302,7 +315,121 @@ static int ts_connect(struct gsm_bts_trx_ts *ts)
 	cr->u8Tn = ts->nr;
 	cr->logChComb = pchan_to_logChComb[ts->pchan];
 	
-	return l1if_req_compl(fl1h, msg, 0, opstart_compl_cb, &ts->mo);
+	return l1if_req_compl(fl1h, msg, 0, cb, data);
+}
+
+static int ts_connect(struct gsm_bts_trx_ts *ts)
+{
+	return ts_mph_connect(ts, opstart_compl_cb, &ts->mo);
+}
+
+/* Restoring the TRX after a reset of the L1, see l1if_recover(): the
+ * TRX and the enabled timeslots are set up like on OPSTART, then every
+ * lchan still known in the hLayer2 table is activated again.  Nothing
+ * of this is reported to the BSC via OML. */
+static void restore_lchans(struct femtol1_hdl *fl1h)
+{
+	struct gsm_lchan *lchans[L1_HL2_NUM];
+	unsigned int i, num = 0;
+
+	/* lchan_activate() modifies the table, so take a snapshot */
+	for (i = 0; i < ARRAY_SIZE(fl1h->hl2_ctx); i++) {
+		if (fl1h->hl2_ctx[i].lchan)
+			lchans[num++] = fl1h->hl2_ctx[i].lchan;
+	}
+
+	if (num == 0) {
+		l1if_recovery_done(fl1h);
+		return;
+	}
+
+	/* the L1 has recovered once the last lchan is confirmed, see
+	 * lchan_restore_done() */
+	fl1h->recovery.pending = num;
+	for (i = 0; i < num; i++) {
+		/* a failed BCCH has started another L1 reset */
+		if (fl1h->recovery.state != L1_RCV_RESTORE)
+			return;
+		LOGP(DL1C, LOGL_INFO, "%s: re-activating after L1 reset\n",
+			gsm_lchan_name(lchans[i]));
+		lchan_act_state(lchans[i])->restore = 1;
+		lchan_activate(lchans[i]);
+	}
+}
+
+static int restore_connect_compl_cb(struct msgb *l1_msg, void *data)
+{
+	struct femtol1_hdl *fl1h = data;
+	GsmL1_Prim_t *l1p = msgb_l1prim(l1_msg);
+	GsmL1_Status_t status = prim_status(l1p);
+
+	msgb_free(l1_msg);
+
+	/* failed by l1if_recover(), which starts all over again */
+	if (fl1h->recovery.state != L1_RCV_RESTORE)
+		return 0;
+
+	if (status != GsmL1_Status_Success) {
+		l1if_recover(fl1h, "MPH-CONNECT failure");
+		return 0;
+	}
+
+	if (--fl1h->recovery.pending == 0)
+		restore_lchans(fl1h);
+
+	return 0;
+}
+
+static int restore_init_compl_cb(struct msgb *l1_msg, void *data)
+{
+	struct femtol1_hdl *fl1h = data;
+	struct gsm_bts_trx *trx = fl1h->priv;
+	GsmL1_MphInitCnf_t *ic = &msgb_l1prim(l1_msg)->u.mphInitCnf;
+	GsmL1_Status_t status = ic->status;
+	uint32_t hLayer1 = ic->hLayer1;
+	unsigned int i;
+
+	msgb_free(l1_msg);
+
+	/* failed by l1if_recover(), which starts all over again */
+	if (fl1h->recovery.state != L1_RCV_RESTORE)
+		return 0;
+
+	fl1h->hLayer1 = hLayer1;
+
+	if (status != GsmL1_Status_Success) {
+		l1if_recover(fl1h, "MPH-INIT failure");
+		return 0;
+	}
+
+	fl1h->recovery.pending = 0;
+	for (i = 0; i < ARRAY_SIZE(trx->ts); i++) {
+		struct gsm_bts_trx_ts *ts = &trx->ts[i];
+
+		if (ts->mo.nm_state.operational != NM_OPSTATE_ENABLED)
+			continue;
+		if (ts_mph_connect(ts, restore_connect_compl_cb, fl1h) < 0) {
+			l1if_recover(fl1h, "MPH-CONNECT failure");
+			return 0;
+		}
+		fl1h->recovery.pending++;
+	}
+
+	if (fl1h->recovery.pending == 0)
+		restore_lchans(fl1h);
+
+	return 0;
+}
+
+int trx_l1_restore(struct gsm_bts_trx *trx)
+{
+	if (trx->mo.nm_state.operational != NM_OPSTATE_ENABLED) {
+		/* the BSC has not yet started the TRX */
+		l1if_recovery_done(trx_femtol1_hdl(trx));
+		return 0;
+	}
+
+	return trx_mph_init(trx, restore_init_compl_cb);
 }
 
 GsmL1_Sapi_t lchan_to_GsmL1_Sapi_t(const struct gsm_lchan *lchan)
@@ -399,74 +526,176 @@ static const struct lchan_sapis sapis_for_lchan[_GSM_LCHAN_MAX] = {
 	},
 };
 
+static struct lchan_act_state *lchan_act_state(struct gsm_lchan *lchan)
+{
+	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
+
+	return &fl1h->act_state[lchan->ts->nr][lchan->nr];
+}
+
+/* what a MPH-ACTIVATE.req has been sent for */
+struct lchan_act_req {
+	struct gsm_lchan *lchan;
+	uint8_t gen;		/* lchan_act_state.gen at the time */
+	uint8_t sapi_idx;	/* index in sapis_for_lchan[] */
+};
+
+static void lchan_deactivate_sapis(struct gsm_lchan *lchan, uint8_t sapis);
+
+/* one lchan less to restore, the L1 has recovered after the last one,
+ * see restore_lchans() */
+static void lchan_restore_done(struct gsm_lchan *lchan)
+{
+	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
+	struct lchan_act_state *st = lchan_act_state(lchan);
+
+	if (!st->restore)
+		return;
+	st->restore = 0;
+
+	if (fl1h->recovery.state == L1_RCV_RESTORE &&
+	    --fl1h->recovery.pending == 0)
+		l1if_recovery_done(fl1h);
+}
+
+/* all SAPIs of the lchan have been confirmed (or failed) */
+static void lchan_act_done(struct gsm_lchan *lchan)
+{
+	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
+	struct lchan_act_state *st = lchan_act_state(lchan);
+	int ack_rsl = st->ack_rsl;
+
+	if (lchan->state != LCHAN_S_ACT_REQ)
+		return;
+
+	st->ack_rsl = 0;
+
+	if (st->failed) {
+		LOGP(DL1C, LOGL_ERROR, "%s activation failed\n",
+			gsm_lchan_name(lchan));
+		/* the restore was cut short by another L1 reset, the
+		 * next restore activates the lchan again */
+		if (st->restore && fl1h->recovery.state == L1_RCV_RESET) {
+			st->restore = 0;
+			return;
+		}
+		/* without the BCCH there is no cell, so try again */
+		if (st->restore && lchan->type == GSM_LCHAN_CCCH) {
+			st->restore = 0;
+			l1if_recover(fl1h, "BCCH restore failure");
+			return;
+		}
+		lchan->state = LCHAN_S_NONE;
+		l1if_hLayer2_unregister(fl1h, lchan);
+		/* the SAPIs that made it would make the next activation
+		 * fail, unless the L1 is being reset anyway */
+		if (st->sapis_active && fl1h->recovery.state != L1_RCV_RESET)
+			lchan_deactivate_sapis(lchan, st->sapis_active);
+		if (ack_rsl)
+			rsl_tx_chan_act_nack(lchan, RSL_ERR_EQUIPMENT_FAIL);
+		else if (st->restore)
+			rsl_tx_conn_fail(lchan, RSL_ERR_EQUIPMENT_FAIL);
+		lchan_restore_done(lchan);
+		return;
+	}
+
+	lchan->state = LCHAN_S_ACTIVE;
+	if (ack_rsl)
+		rsl_tx_chan_act_ack(lchan,
+				    bts_model_get_time(lchan->ts->trx->bts));
+	lchan_restore_done(lchan);
+}
+
 static int lchan_act_compl_cb(struct msgb *l1_msg, void *data)
 {
-	struct gsm_lchan *lchan = data;
+	struct lchan_act_req *req = data;
+	struct gsm_lchan *lchan = req->lchan;
+	struct lchan_act_state *st = lchan_act_state(lchan);
+	uint8_t gen = req->gen, sapi_idx = req->sapi_idx;
 	GsmL1_Prim_t *l1p = msgb_l1prim(l1_msg);
 	GsmL1_MphActivateCnf_t *ic = &l1p->u.mphActivateCnf;
 
+	talloc_free(req);
+
 	LOGP(DL1C, LOGL_INFO, "%s MPH-ACTIVATE.conf\n", gsm_lchan_name(lchan));
 
+	/* the lchan was released while we were activating it, and
+	 * maybe activated once more since */
+	if (lchan->state != LCHAN_S_ACT_REQ || gen != st->gen) {
+		LOGP(DL1C, LOGL_NOTICE, "%s MPH-ACTIVATE.conf of an earlier "
+			"activation, ignoring\n", gsm_lchan_name(lchan));
+		msgb_free(l1_msg);
+		return 0;
+	}
+
 	if (ic->status == GsmL1_Status_Success) {
 		DEBUGP(DL1C, "Successful activation of L1 SAPI %s on TS %u\n",
 			get_value_string(femtobts_l1sapi_names, ic->sapi), ic->u8Tn);
-		lchan->state = LCHAN_S_ACTIVE;
+		st->sapis_active |= 1 << sapi_idx;
 	} else {
 		LOGP(DL1C, LOGL_ERROR, "Error activating L1 SAPI %s on TS %u: %s\n",
 			get_value_string(femtobts_l1sapi_names, ic->sapi), ic->u8Tn,
 			get_value_string(femtobts_l1status_names, ic->status));
-		lchan->state = LCHAN_S_NONE;
-	}
-
-	switch (ic->sapi) {
-	case GsmL1_Sapi_Sdcch:
-	case GsmL1_Sapi_TchF:
-		/* FIXME: Send RSL CHAN ACT */
-		break;
-	default:
-		break;
+		st->failed = 1;
 	}
 
 	msgb_free(l1_msg);
 
+	if (st->sapis_pending && --st->sapis_pending == 0)
+		lchan_act_done(lchan);
+
 	return 0;
 }
 
 uint32_t l1if_lchan_to_hLayer2(struct gsm_lchan *lchan)
 {
-	return (lchan->nr << 8) | (lchan->ts->nr << 16) | (lchan->ts->trx->nr << 24);
+	return lchan->nr | (lchan->ts->nr << 3) | (lchan->ts->trx->nr << 8);
 }
 
-/* obtain a ptr to the lapdm_channel for a given hLayer2 */
-struct gsm_lchan *
-l1if_hLayer2_to_lchan(struct gsm_bts_trx *trx, uint32_t hLayer2)
+/* make the hLayer2 of the lchan known to l1if_hLayer2_ctx() */
+void l1if_hLayer2_register(struct femtol1_hdl *fl1h, struct gsm_lchan *lchan)
 {
-	uint8_t ts_nr = (hLayer2 >> 16) & 0xff;
-	uint8_t lchan_nr = (hLayer2 >> 8)& 0xff;
-	struct gsm_bts_trx_ts *ts;
+	uint32_t hLayer2 = l1if_lchan_to_hLayer2(lchan);
+	struct l1_hl2_ctx *ctx = &fl1h->hl2_ctx[hLayer2 % L1_HL2_NUM];
+
+	ctx->hLayer2 = hLayer2;
+	ctx->lchan = lchan;
+	ctx->lc = &lchan->lapdm_ch;
+	ctx->chan_nr = gsm_lchan2chan_nr(lchan);
+	ctx->tch_last_fn_valid = 0;
+}
 
-	/* FIXME: if we actually run on the BTS, the 32bit field is large
-	 * enough to simply put a pointer inside. */
-	if (ts_nr >= ARRAY_SIZE(trx->ts))
-		return NULL;
+void l1if_hLayer2_unregister(struct femtol1_hdl *fl1h, struct gsm_lchan *lchan)
+{
+	uint32_t hLayer2 = l1if_lchan_to_hLayer2(lchan);
 
-	ts = &trx->ts[ts_nr];
+	memset(&fl1h->hl2_ctx[hLayer2 % L1_HL2_NUM], 0,
+		sizeof(struct l1_hl2_ctx));
+}
+
+/* obtain the lchan for a given hLayer2 */
+struct gsm_lchan *
+l1if_hLayer2_to_lchan(struct gsm_bts_trx *trx, uint32_t hLayer2)
+{
+	const struct l1_hl2_ctx *ctx;
 
-	if (lchan_nr >= ARRAY_SIZE(ts->lchan))
+	ctx = l1if_hLayer2_ctx(trx_femtol1_hdl(trx), hLayer2);
+	if (!ctx)
 		return NULL;
 
-	return &ts->lchan[lchan_nr];
+	return ctx->lchan;
 }
 
 /* we regularly check if the DSP L1 is still sending us primitives.
- * if not, we simply stop the BTS program (and be re-spawned) */
+ * if not, we reset the L1 and restore its state, see l1if_recover() */
 static void alive_timer_cb(void *data)
 {
 	struct femtol1_hdl *fl1h = data;
 
 	if (fl1h->alive_prim_cnt == 0) {
-		LOGP(DL1C, LOGL_FATAL, "DSP L1 is no longer sending primitives!\n");
-		exit(23);
+		/* re-armed once the SCH is activated again */
+		l1if_recover(fl1h, "DSP L1 is no longer sending primitives");
+		return;
 	}
 	fl1h->alive_prim_cnt = 0;
 	osmo_timer_schedule(&fl1h->alive_timer, 5, 0);
@@ -552,13 +781,9 @@ static void lchan2lch_par(GsmL1_LogChParam_t *lch_par, struct gsm_lchan *lchan)
 			lch_par->tch.amrActiveCodecSet[j++] = GsmL1_AmrCodec_12_2;
 		break;
 	case GSM48_CMODE_SPEECH_EFR:
-#ifdef GsmL1_TchPlType_Efr
 		lch_par->tch.tchPlType = GsmL1_TchPlType_Efr;
 		clear_amr_params(lch_par);
 		break;
-#else
-#warning No EFR support in L1
-#endif
 	case GSM48_CMODE_DATA_14k5:
 	case GSM48_CMODE_DATA_12k0:
 	case GSM48_CMODE_DATA_6k0:
@@ -569,16 +794,33 @@ static void lchan2lch_par(GsmL1_LogChParam_t *lch_par, struct gsm_lchan *lchan)
 	}
 }
 
+/* Activate all SAPIs of the lchan.  The MPH-ACTIVATE.req of all of
+ * them are sent at once, and the lchan becomes active when the last
+ * one has been confirmed. */
 int lchan_activate(struct gsm_lchan *lchan)
 {
 	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
 	const struct lchan_sapis *s4l = &sapis_for_lchan[lchan->type];
+	struct lchan_act_state *st = lchan_act_state(lchan);
 	unsigned int i;
 
+	lchan->state = LCHAN_S_ACT_REQ;
+	st->gen++;
+	st->sapis_pending = 0;
+	st->sapis_active = 0;
+	st->failed = 0;
+
+	/* the L1 may send indications as soon as the first SAPI is
+	 * active */
+	l1if_hLayer2_register(fl1h, lchan);
+	tch_dl_flush(lchan);
+	l1if_tch_amr_reset(lchan);
+
 	for (i = 0; i < s4l->num_sapis; i++) {
 		struct msgb *msg = l1p_msgb_alloc();
 		GsmL1_MphActivateReq_t *act_req;
 		GsmL1_LogChParam_t *lch_par;
+		struct lchan_act_req *req;
 
 		act_req = prim_init(msgb_l1prim(msg), GsmL1_PrimId_MphActivateReq, fl1h);
 		lch_par = &act_req->logChPrm;
@@ -621,13 +863,26 @@ int lchan_activate(struct gsm_lchan *lchan)
 			gsm_lchan_name(lchan), act_req->hLayer2, i,
 			get_value_string(femtobts_l1sapi_names, act_req->sapi));
 
-		/* send the primitive for all GsmL1_Sapi_* that match the LCHAN */
-		l1if_req_compl(fl1h, msg, 0, lchan_act_compl_cb, lchan);
+		req = talloc_zero(fl1h, struct lchan_act_req);
+		req->lchan = lchan;
+		req->gen = st->gen;
+		req->sapi_idx = i;
 
+		/* send the primitive for all GsmL1_Sapi_* that match the LCHAN */
+		if (l1if_req_compl(fl1h, msg, 0, lchan_act_compl_cb, req) < 0) {
+			msgb_free(msg);
+			talloc_free(req);
+			st->failed = 1;
+		} else
+			st->sapis_pending++;
 	}
-	lchan->state = LCHAN_S_ACT_REQ;
 
-	lchan_init_lapdm(lchan);
+	/* keep the LAPDm state of lchans we restore after a L1 reset */
+	if (fl1h->recovery.state != L1_RCV_RESTORE)
+		lchan_init_lapdm(lchan);
+
+	if (st->sapis_pending == 0)
+		lchan_act_done(lchan);
 
 	return 0;
 }
@@ -744,6 +999,10 @@ int bts_model_rsl_mode_modify(struct gsm_lchan *lchan)
 {
 	/* channel mode, encryption and/or multirate have changed */
 
+	/* frames queued for the old mode are of no use anymore */
+	tch_dl_flush(lchan);
+	l1if_tch_amr_reset(lchan);
+
 	/* update multi-rate config */
 	tx_confreq_logchpar(lchan, GsmL1_Dir_RxUplink);
 	tx_confreq_logchpar(lchan, GsmL1_Dir_TxDownlink);
@@ -766,14 +1025,17 @@ static int lchan_deact_compl_cb(struct msgb *l1_msg, void *data)
 	if (ic->status == GsmL1_Status_Success) {
 		DEBUGP(DL1C, "Successful deactivation of L1 SAPI %s on TS %u\n",
 			get_value_string(femtobts_l1sapi_names, ic->sapi), ic->u8Tn);
-		lchan->state = LCHAN_S_ACTIVE;
 	} else {
 		LOGP(DL1C, LOGL_ERROR, "Error deactivating L1 SAPI %s on TS %u: %s\n",
 			get_value_string(femtobts_l1sapi_names, ic->sapi), ic->u8Tn,
 			get_value_string(femtobts_l1status_names, ic->status));
-		lchan->state = LCHAN_S_NONE;
 	}
 
+	/* a lchan we release is gone either way, while deactivating
+	 * only the SACCH leaves an active lchan active */
+	if (lchan->state == LCHAN_S_REL_REQ)
+		lchan->state = LCHAN_S_NONE;
+
 	switch (ic->sapi) {
 	case GsmL1_Sapi_Sdcch:
 	case GsmL1_Sapi_TchF:
@@ -788,16 +1050,22 @@ static int lchan_deact_compl_cb(struct msgb *l1_msg, void *data)
 	return 0;
 }
 
-int lchan_deactivate(struct gsm_lchan *lchan)
+/* send MPH-DEACTIVATE.req for the SAPIs of the lchan in the bit mask,
+ * by their index in sapis_for_lchan[] */
+static void lchan_deactivate_sapis(struct gsm_lchan *lchan, uint8_t sapis)
 {
 	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
 	const struct lchan_sapis *s4l = &sapis_for_lchan[lchan->type];
 	int i;
 
 	for (i = s4l->num_sapis-1; i >= 0; i--) {
-		struct msgb *msg = l1p_msgb_alloc();
+		struct msgb *msg;
 		GsmL1_MphDeactivateReq_t *deact_req;
 
+		if (!(sapis & (1 << i)))
+			continue;
+
+		msg = l1p_msgb_alloc();
 		deact_req = prim_init(msgb_l1prim(msg), GsmL1_PrimId_MphDeactivateReq, fl1h);
 		deact_req->u8Tn = lchan->ts->nr;
 		deact_req->subCh = lchan_to_GsmL1_SubCh_t(lchan);
@@ -816,7 +1084,27 @@ int lchan_deactivate(struct gsm_lchan *lchan)
 		l1if_req_compl(fl1h, msg, 0, lchan_deact_compl_cb, lchan);
 
 	}
-	lchan->state = LCHAN_S_ACT_REQ;
+}
+
+int lchan_deactivate(struct gsm_lchan *lchan)
+{
+	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
+	struct lchan_act_state *st = lchan_act_state(lchan);
+
+	/* forget an activation still in progress, its confirmations
+	 * must neither ACK the CHAN ACT nor make the lchan active */
+	lchan->state = LCHAN_S_REL_REQ;
+	st->gen++;
+	st->sapis_pending = 0;
+	st->failed = 0;
+	st->ack_rsl = 0;
+	lchan_restore_done(lchan);
+
+	/* ignore whatever the L1 still sends for this lchan */
+	l1if_hLayer2_unregister(fl1h, lchan);
+	tch_dl_flush(lchan);
+
+	lchan_deactivate_sapis(lchan, 0xff);
 
 	return 0;
 }
@@ -902,10 +1190,11 @@ int bts_model_rsl_chan_act(struct gsm_lchan *lchan, struct tlv_parsed *tp)
 	//uint8_t mode = *TLVP_VAL(tp, RSL_IE_CHAN_MODE);
 	//uint8_t type = *TLVP_VAL(tp, RSL_IE_ACT_TYPE);
 
-	lchan_activate(lchan);
-	/* FIXME: only do this in case of success */
+	/* the CHAN ACT ACK (or NACK) is sent once the L1 has confirmed
+	 * all SAPIs of the lchan */
+	lchan_act_state(lchan)->ack_rsl = 1;
 
-	return rsl_tx_chan_act_ack(lchan, bts_model_get_time(lchan->ts->trx->bts));
+	return lchan_activate(lchan);
 }
 
 int bts_model_rsl_chan_rel(struct gsm_lchan *lchan)
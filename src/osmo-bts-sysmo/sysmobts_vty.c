@@ -235,6 +235,115 @@ DEFUN(show_sys_info, show_sys_info_cmd,
 			vty_out(vty, "%s ",  gsm_band_name(1 << i));
 	}
 	vty_out(vty, "%s", VTY_NEWLINE);
+	vty_out(vty, "L1 recoveries: %u%s", fl1h->recovery.count, VTY_NEWLINE);
+
+	return CMD_SUCCESS;
+}
+
+static void show_prim_pool(struct vty *vty, const char *name,
+			   struct l1prim_pool *pool)
+{
+	vty_out(vty, "%s: %u msgbs, %u in use, %u taken from pool, "
+		"%u allocated (pool empty)%s", name, pool->size,
+		pool->size - pool->num_free, pool->stats.get,
+		pool->stats.alloc, VTY_NEWLINE);
+}
+
+DEFUN(show_prim_pool, show_prim_pool_cmd,
+	"show trx <0-0> primitive-pool",
+	SHOW_TRX_STR "Display the usage of the L1 primitive pools\n")
+{
+	int trx_nr = atoi(argv[0]);
+	struct gsm_bts_trx *trx = gsm_bts_trx_num(vty_bts, trx_nr);
+	struct femtol1_hdl *fl1h;
+
+	if (!trx) {
+		vty_out(vty, "Cannot find TRX number %u%s",
+			trx_nr, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	fl1h = trx_femtol1_hdl(trx);
+
+	show_prim_pool(vty, "Tx", fl1h->tx_pool);
+	show_prim_pool(vty, "Rx", fl1h->rx_pool);
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_l1_latency, show_l1_latency_cmd,
+	"show trx <0-0> l1-latency",
+	SHOW_TRX_STR "Display the latency of the answers to PH-RTS.ind\n")
+{
+	int trx_nr = atoi(argv[0]);
+	struct gsm_bts_trx *trx = gsm_bts_trx_num(vty_bts, trx_nr);
+	struct femtol1_hdl *fl1h;
+	int sapi, i;
+
+	if (!trx) {
+		vty_out(vty, "Cannot find TRX number %u%s",
+			trx_nr, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	fl1h = trx_femtol1_hdl(trx);
+
+	vty_out(vty, "%-8s %-13s %9s %7s %7s %7s %7s %7s (us)%s",
+		"SAPI", "Interval", "Count", "Mean", "p50", "p99", "p99.9",
+		"Max", VTY_NEWLINE);
+
+	for (sapi = 0; sapi < GsmL1_Sapi_NUM; sapi++) {
+		for (i = 0; i < _NUM_L1_LAT; i++) {
+			struct l1_lat_hist *h = &fl1h->lat.hist[sapi][i];
+
+			if (!h->count)
+				continue;
+
+			vty_out(vty, "%-8s %-13s %9u %7u %7u %7u %7u %7u%s",
+				get_value_string(femtobts_l1sapi_names, sapi),
+				get_value_string(l1_lat_interval_names, i),
+				h->count, (unsigned int) (h->sum / h->count),
+				l1_lat_hist_percentile(h, 500),
+				l1_lat_hist_percentile(h, 990),
+				l1_lat_hist_percentile(h, 999),
+				h->max, VTY_NEWLINE);
+		}
+	}
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_tch_queue, show_tch_queue_cmd,
+	"show trx <0-0> tch-queue",
+	SHOW_TRX_STR "Display the downlink TCH queues of the lchans\n")
+{
+	int trx_nr = atoi(argv[0]);
+	struct gsm_bts_trx *trx = gsm_bts_trx_num(vty_bts, trx_nr);
+	struct femtol1_hdl *fl1h;
+	unsigned int tn, ln;
+
+	if (!trx) {
+		vty_out(vty, "Cannot find TRX number %u%s",
+			trx_nr, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	fl1h = trx_femtol1_hdl(trx);
+
+	vty_out(vty, "%-2s %-5s %5s %6s %11s %9s %9s %9s%s",
+		"TS", "Lchan", "Depth", "Target", "Jitter (us)", "Queued",
+		"Dropped", "Underruns", VTY_NEWLINE);
+
+	for (tn = 0; tn < ARRAY_SIZE(fl1h->tch_dl); tn++) {
+		for (ln = 0; ln < ARRAY_SIZE(fl1h->tch_dl[tn]); ln++) {
+			struct tch_dl_ring *r = &fl1h->tch_dl[tn][ln];
+
+			if (!r->stats.enqueued)
+				continue;
+
+			vty_out(vty, "%-2u %-5u %5u %6u %11u %9u %9u %9u%s",
+				tn, ln, r->depth, r->target, r->jitter >> 4,
+				r->stats.enqueued, r->stats.dropped,
+				r->stats.underruns, VTY_NEWLINE);
+		}
+	}
 
 	return CMD_SUCCESS;
 }
@@ -265,6 +374,9 @@ int bts_model_vty_init(struct gsm_bts *bts)
 
 	install_element_ve(&show_dsp_trace_f_cmd);
 	install_element_ve(&show_sys_info_cmd);
+	install_element_ve(&show_prim_pool_cmd);
+	install_element_ve(&show_tch_queue_cmd);
+	install_element_ve(&show_l1_latency_cmd);
 	install_element_ve(&dsp_trace_f_cmd);
 	install_element_ve(&no_dsp_trace_f_cmd);
 
@@ -39,6 +39,7 @@
 #include <osmo-bts/bts.h>
 #include <osmo-bts/gsm_data.h>
 #include <osmo-bts/measurement.h>
+#include <osmo-bts/amr.h>
 /*
 #include <sysmocom/femtobts/femtobts.h>
 #include <sysmocom/femtobts/gsml1prim.h>
@@ -48,74 +49,35 @@
 #include "gsmL1prim.h"
 #include "femtobts.h"
 #include "l1_if.h"
-
-/* input octet-aligned, output not octet-aligned */
-void osmo_nibble_shift_right(uint8_t *out, const uint8_t *in,
-			     unsigned int num_nibbles)
-{
-	unsigned int i;
-	unsigned int num_whole_bytes = num_nibbles / 2;
-
-	/* first byte: upper nibble empty, lower nibble from src */
-	out[0] = (in[0] >> 4);
-
-	/* bytes 1.. */
-	for (i = 1; i < num_whole_bytes; i++)
-		out[i] = ((in[i-1] & 0xF) << 4) | (in[i] >> 4);
-
-	/* shift the last nibble, in case there's an odd count */
-	i = num_whole_bytes;
-	if (num_nibbles & 1)
-		out[i] = ((in[i-1] & 0xF) << 4) | (in[i] >> 4);
-	else
-		out[i] = (in[i-1] & 0xF) << 4;
-}
-
-
-/* input unaligned, output octet-aligned */
-void osmo_nibble_shift_left_unal(uint8_t *out, const uint8_t *in,
-				unsigned int num_nibbles)
-{
-	unsigned int i;
-	unsigned int num_whole_bytes = num_nibbles / 2;
-
-	for (i = 0; i < num_whole_bytes; i++)
-		out[i] = ((in[i] & 0xF) << 4) | (in[i+1] >> 4);
-
-	/* shift the last nibble, in case there's an odd count */
-	i = num_whole_bytes;
-	if (num_nibbles & 1)
-		out[i] = (in[i] & 0xF) << 4;
-}
-
+#include "tch_repack.h"
 
 #define GSM_FR_BITS	260
-#define GSM_EFR_BITS	244
 
 #define GSM_FR_BYTES	33	/* TS 101318 Chapter 5.1: 260 bits + 4bit sig */
 #define GSM_HR_BYTES	14	/* TS 101318 Chapter 5.2: 112 bits, no sig */
-#define GSM_EFR_BYTES	31	/* TS 101318 Chapter 5.3: 244 bits + 4bit sig */
-
-static struct msgb *l1_to_rtppayload_fr(uint8_t *l1_payload, uint8_t payload_len)
-{
-	struct msgb *msg;
-	uint8_t *cur;
-
-	msg = msgb_alloc_headroom(1024, 128, "L1C-to-RTP");
-	if (!msg)
-		return NULL;
 
-	/* step1: reverse the bit-order of each payload byte */
-	osmo_revbytebits_buf(l1_payload, payload_len);
+/* AMR 12.2 in IF2: 4 bit FT and 244 bits of speech */
+#define AMR_IF2_MAX_BYTES	31
 
-	cur = msgb_put(msg, GSM_FR_BYTES);
+/* room for the largest RTP payload of any of the above */
+#define RTP_PL_MAX_LEN		GSM_FR_BYTES
 
-	/* step2: we need to shift the entire L1 payload by 4 bits right */
-	osmo_nibble_shift_right(cur, l1_payload, GSM_FR_BITS/4);
+/*! \brief convert GSM-FR from L1 format to RTP payload
+ *  \param[out] rtp_pl RTP payload, RTP_PL_MAX_LEN bytes
+ *  \param[in] l1_payload payload part of L1 buffer
+ *  \param[in] payload_len length of \a l1_payload
+ *  \returns number of \a rtp_pl bytes filled
+ */
+static int l1_to_rtppayload_fr(uint8_t *rtp_pl, const uint8_t *l1_payload,
+			       uint8_t payload_len)
+{
+	/* reverse the bit-order of each payload byte and shift the
+	 * entire L1 payload by 4 bits right */
+	tch_rev_shift_right(rtp_pl, l1_payload, GSM_FR_BITS/4);
 
-	cur[0] |= 0xD0;
+	rtp_pl[0] |= 0xD0;
 
-	return msg;
+	return GSM_FR_BYTES;
 }
 
 /*! \brief convert GSM-FR from RTP payload to L1 format
@@ -127,63 +89,69 @@ static struct msgb *l1_to_rtppayload_fr(uint8_t *l1_payload, uint8_t payload_len
 static int rtppayload_to_l1_fr(uint8_t *l1_payload, const uint8_t *rtp_payload,
 				unsigned int payload_len)
 {
-	/* step2: we need to shift the RTP payload left by one nibble*/
-	osmo_nibble_shift_left_unal(l1_payload, rtp_payload, GSM_FR_BITS/4);
-
-	/* step1: reverse the bit-order of each payload byte */
-	osmo_revbytebits_buf(l1_payload, payload_len);
+	/* shift the RTP payload left by one nibble and reverse the
+	 * bit-order of each payload byte */
+	tch_shift_left_rev(l1_payload, rtp_payload, GSM_FR_BITS/4);
 
 	return GSM_FR_BYTES;
 }
 
-#ifdef GsmL1_TchPlType_Efr
-static struct msgb *l1_to_rtppayload_efr(uint8_t *l1_payload, uint8_t payload_len)
+/*! \brief convert GSM-EFR from L1 format to RTP payload
+ *  \param[out] rtp_pl RTP payload, RTP_PL_MAX_LEN bytes
+ *  \param[in] l1_payload payload part of L1 buffer
+ *  \param[in] payload_len length of \a l1_payload
+ *  \returns number of \a rtp_pl bytes filled
+ */
+static int l1_to_rtppayload_efr(uint8_t *rtp_pl, const uint8_t *l1_payload,
+				uint8_t payload_len)
 {
-	struct msgb *msg;
-	uint8_t *cur;
-
-	msg = msgb_alloc_headroom(1024, 128, "L1C-to-RTP");
-	if (!msg)
-		return NULL;
+	int rc;
 
-	/* step1: reverse the bit-order of each payload byte */
-	osmo_revbytebits_buf(l1_payload, payload_len);
+	/* reverse the bit-order of each payload byte and shift the
+	 * entire L1 payload by 4 bits right */
+	rc = tch_l1_to_rtp_efr(rtp_pl, l1_payload, payload_len);
+	if (rc < 0)
+		LOGP(DL1C, LOGL_ERROR, "L1 EFR frame length %u < expected %u\n",
+			payload_len, GSM_EFR_BYTES);
 
-	cur = msgb_put(msg, GSM_EFR_BYTES);
+	return rc;
+}
 
-	/* step 2: we need to shift the entire L1 payload by 4 bits right */
-	osmo_nibble_shift_right(cur, l1_payload, GSM_EFR_BITS/4);
+/*! \brief convert GSM-EFR from RTP payload to L1 format
+ *  \param[out] l1_payload payload part of L1 buffer
+ *  \param[in] rtp_payload pointer to RTP payload data
+ *  \param[in] payload_len length of \a rtp_payload
+ *  \returns number of \a l1_payload bytes filled
+ */
+static int rtppayload_to_l1_efr(uint8_t *l1_payload, const uint8_t *rtp_payload,
+				unsigned int payload_len)
+{
+	int rc;
 
-	cur[0] |= 0xC0;
+	/* shift the RTP payload left by one nibble and reverse the
+	 * bit-order of each payload byte */
+	rc = tch_rtp_to_l1_efr(l1_payload, rtp_payload, payload_len);
+	if (rc < 0)
+		LOGP(DRTP, LOGL_ERROR, "RTP EFR frame invalid (length %u, "
+			"expected %u, first octet 0x%02x)\n", payload_len,
+			GSM_EFR_BYTES, payload_len ? rtp_payload[0] : 0);
 
-	return msg;
+	return rc;
 }
-#else
-#warning No EFR support in L1
-#endif
 
-static struct msgb *l1_to_rtppayload_hr(uint8_t *l1_payload, uint8_t payload_len)
+static int l1_to_rtppayload_hr(uint8_t *rtp_pl, const uint8_t *l1_payload,
+			       uint8_t payload_len)
 {
-	struct msgb *msg;
-	uint8_t *cur;
-
-	msg = msgb_alloc_headroom(1024, 128, "L1C-to-RTP");
-	if (!msg)
-		return NULL;
-
 	if (payload_len != GSM_HR_BYTES) {
 		LOGP(DL1C, LOGL_ERROR, "L1 HR frame length %u != expected %u\n",
 			payload_len, GSM_HR_BYTES);
-		return NULL;
+		return -EINVAL;
 	}
 
-	cur = msgb_put(msg, GSM_HR_BYTES);
-	memcpy(cur, l1_payload, GSM_HR_BYTES);
-
 	/* reverse the bit-order of each payload byte */
-	osmo_revbytebits_buf(cur, GSM_HR_BYTES);
+	tch_rev_copy(rtp_pl, l1_payload, GSM_HR_BYTES);
 
-	return msg;
+	return GSM_HR_BYTES;
 }
 
 /*! \brief convert GSM-FR from RTP payload to L1 format
@@ -202,10 +170,8 @@ static int rtppayload_to_l1_hr(uint8_t *l1_payload, const uint8_t *rtp_payload,
 		return 0;
 	}
 
-	memcpy(l1_payload, rtp_payload, GSM_HR_BYTES);
-
 	/* reverse the bit-order of each payload byte */
-	osmo_revbytebits_buf(l1_payload, GSM_HR_BYTES);
+	tch_rev_copy(l1_payload, rtp_payload, GSM_HR_BYTES);
 
 	return GSM_HR_BYTES;
 }
@@ -213,55 +179,147 @@ static int rtppayload_to_l1_hr(uint8_t *l1_payload, const uint8_t *rtp_payload,
 #define AMR_TOC_QBIT	0x04
 #define AMR_CMR_NONE	0xF
 
-static struct msgb *l1_to_rtppayload_amr(uint8_t *l1_payload, uint8_t payload_len,
-					 struct amr_multirate_conf *amr_mrc)
+/* weight of a new C/I measurement in the average: 1/AMR_CI_AVG */
+#define AMR_CI_AVG	4
+
+static struct amr_lchan_state *lchan_amr_state(struct gsm_lchan *lchan)
 {
-	struct msgb *msg;
-	uint8_t *cur;
+	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
+
+	return &fl1h->amr[lchan->ts->nr][lchan->nr];
+}
+
+/* index of the fastest mode of the active set not faster than mode */
+static uint8_t amr_mode_idx_at_most(const struct amr_multirate_conf *amr_mrc,
+				    uint8_t mode)
+{
+	uint8_t i, idx = 0;
+
+	for (i = 0; i < amr_mrc->num_modes; i++) {
+		if (amr_mrc->mode[i].mode <= mode)
+			idx = i;
+	}
+	return idx;
+}
+
+/*! \brief start the AMR state of an lchan over with the initial mode */
+void l1if_tch_amr_reset(struct gsm_lchan *lchan)
+{
+	struct amr_lchan_state *st = lchan_amr_state(lchan);
+	uint8_t num_modes = lchan->tch.amr_mr.num_modes;
+	uint8_t mode = amr_get_initial_mode(lchan);
+
+	if (num_modes && mode >= num_modes)
+		mode = num_modes - 1;
+
+	memset(st, 0, sizeof(*st));
+	st->ul_cmi = st->ul_cmc = st->dl_cmi = mode;
+}
+
+/*! \brief feed the C/I of an uplink TCH block into the AMR link adaptation
+ *
+ * The averaged C/I decides which codec mode we command the MS to use in
+ * the uplink, one step at a time: below the threshold between the
+ * current and the next more robust mode we go down, above the threshold
+ * plus hysteresis to the next faster mode we go up (TS 45.009 3.2).
+ */
+void l1if_tch_amr_meas(struct gsm_lchan *lchan, float ci_db)
+{
+	struct amr_multirate_conf *amr_mrc = &lchan->tch.amr_mr;
+	struct amr_lchan_state *st = lchan_amr_state(lchan);
+	uint8_t cmc = st->ul_cmc;
+
+	if (lchan->tch_mode != GSM48_CMODE_SPEECH_AMR ||
+	    amr_mrc->num_modes < 2)
+		return;
+
+	if (!st->ul_ci_valid) {
+		st->ul_ci = ci_db;
+		st->ul_ci_valid = 1;
+	} else
+		st->ul_ci += (ci_db - st->ul_ci) / AMR_CI_AVG;
+
+	/* thresholds and hysteresis are in steps of 0.5 dB, the ones of
+	 * mode[i] are those between mode i and i+1 */
+	if (cmc > 0 && st->ul_ci < amr_mrc->mode[cmc-1].threshold / 2.0f)
+		cmc--;
+	else if (cmc + 1 < amr_mrc->num_modes &&
+		 st->ul_ci >= (amr_mrc->mode[cmc].threshold +
+			       amr_mrc->mode[cmc].hysteresis) / 2.0f)
+		cmc++;
+
+	if (cmc != st->ul_cmc) {
+		LOGP(DL1C, LOGL_INFO, "%s AMR UL codec mode %u -> %u "
+			"(C/I %.1f dB)\n", gsm_lchan_name(lchan),
+			amr_mrc->mode[st->ul_cmc].mode, amr_mrc->mode[cmc].mode,
+			st->ul_ci);
+		st->ul_cmc = cmc;
+	}
+}
+
+static int l1_to_rtppayload_amr(uint8_t *rtp_pl, const uint8_t *l1_payload,
+				uint8_t payload_len,
+				struct gsm_lchan *lchan)
+{
+	struct amr_multirate_conf *amr_mrc = &lchan->tch.amr_mr;
+	struct amr_lchan_state *st = lchan_amr_state(lchan);
 	u_int8_t cmr;
+	uint8_t cmi_idx = l1_payload[0];
+	uint8_t cmr_idx = l1_payload[1];
 	uint8_t ft = l1_payload[2] & 0xF;
 	uint8_t amr_if2_len = payload_len - 2;
 
-	msg = msgb_alloc_headroom(1024, 128, "L1C-to-RTP");
-	if (!msg)
-		return NULL;
+	if (payload_len < 3 || amr_if2_len > AMR_IF2_MAX_BYTES) {
+		LOGP(DL1C, LOGL_ERROR, "L1 AMR frame length %u invalid\n",
+			payload_len);
+		return -EINVAL;
+	}
 
-#if 0
-	uint8_t cmr_idx = l1_payload[1];
+	/* The MS sends CMI and CMR in alternate blocks, Unset means it
+	 * was not transmitted at this TDMA */
+	if (cmi_idx < GsmL1_AmrCodecMode_Unset &&
+	    cmi_idx < amr_mrc->num_modes)
+		st->ul_cmi = cmi_idx;
+	if (cmr_idx < GsmL1_AmrCodecMode_Unset) {
+		if (cmr_idx < amr_mrc->num_modes) {
+			st->ul_cmr = cmr_idx;
+			st->ul_cmr_valid = 1;
+		} else {
+			/* Make sure the CMR of the phone is in the active
+			 * codec set */
+			LOGP(DL1C, LOGL_NOTICE, "L1->RTP: ignoring CMR IDX %u\n",
+				cmr_idx);
+		}
+	}
 
-	/* CMR == Unset means CMR was not transmitted at this TDMA */
-	if (cmr_idx >= GsmL1_AmrCodecMode_Unset)
-		cmr = AMR_CMR_NONE;
-	else if (cmr_idx >= amr_mrc->num_modes) {
-		/* Make sure the CMR of the phone is in the active codec set */
-		LOGP(DL1C, LOGL_NOTICE, "L1->RTP: overriding CMR IDX %u\n", cmr_idx);
+	/* ask the RTP peer for the mode the MS requested last */
+	if (st->ul_cmr_valid)
+		cmr = amr_mrc->mode[st->ul_cmr].mode;
+	else
 		cmr = AMR_CMR_NONE;
-	} else {
-		cmr = amr_mrc->mode[cmr_idx].mode;
-	}
-#else
-	cmr = AMR_CMR_NONE;
-#endif
 
 	/* RFC 3267  4.4.1 Payload Header */
-	msgb_put_u8(msg, (cmr << 4));
+	rtp_pl[0] = cmr << 4;
 
 	/* RFC 3267  AMR TOC */
-	msgb_put_u8(msg, AMR_TOC_QBIT | (ft << 3));
-
-	cur = msgb_put(msg, amr_if2_len-1);
-
-	/* step1: reverse the bit-order within every byte */
-	osmo_revbytebits_buf(l1_payload+2, amr_if2_len);
+	rtp_pl[1] = AMR_TOC_QBIT | (ft << 3);
 
-	/* step2: shift everything left by one nibble */
-	osmo_nibble_shift_left_unal(cur, l1_payload+2, amr_if2_len*2 -1);
+	/* reverse the bit-order within every byte and shift everything
+	 * left by one nibble */
+	tch_rev_shift_left(rtp_pl+2, l1_payload+2, amr_if2_len*2 -1);
 
-	return msg;
+	return 2 + amr_if2_len-1;
 }
 
 enum amr_frame_type {
 	AMR_FT_SID_AMR	= 8,
+	AMR_FT_NO_DATA	= 15,
+};
+
+/* speech bits of the AMR frame types, TS 26.101 Table 1a */
+static const uint8_t amr_ft_bits[] = {
+	95, 103, 118, 134, 148, 159, 204, 244,
+	[AMR_FT_SID_AMR] = 39,
 };
 
 int get_amr_mode_idx(const struct amr_multirate_conf *amr_mrc, uint8_t cmi)
@@ -278,26 +336,68 @@ int get_amr_mode_idx(const struct amr_multirate_conf *amr_mrc, uint8_t cmi)
  *  \param[out] l1_payload payload part of L1 buffer
  *  \param[in] rtp_payload pointer to RTP payload data
  *  \param[in] payload_len length of \a rtp_payload
- *  \returns number of \a l1_payload bytes filled
+ *  \returns number of \a l1_payload bytes filled, 0 if there is no
+ *  speech frame to send
  */
 static int rtppayload_to_l1_amr(uint8_t *l1_payload, const uint8_t *rtp_payload,
-				uint8_t payload_len,
+				unsigned int payload_len,
 				struct gsm_lchan *lchan)
 {
 	struct amr_multirate_conf *amr_mrc = &lchan->tch.amr_mr;
-	uint8_t ft = (rtp_payload[1] >> 3) & 0xf;
-	uint8_t cmr = rtp_payload[0] >> 4;
+	struct amr_lchan_state *st = lchan_amr_state(lchan);
+	uint8_t ft, cmr;
 	uint8_t cmi, sti;
 	uint8_t *l1_cmi_idx = l1_payload;
 	uint8_t *l1_cmr_idx = l1_payload+1;
-	uint8_t amr_if2_core_len = payload_len - 2;
+	unsigned int amr_if2_core_len;
 	int rc;
 
-	/* step1: shift everything right one nibble; make space for FT */
-	osmo_nibble_shift_right(l1_payload+2, rtp_payload+2, amr_if2_core_len*2);
-	/* step2: reverse the bit-order within every byte of the IF2
-	 * core frame contained in the RTP payload */
-	osmo_revbytebits_buf(l1_payload+2, amr_if2_core_len+1);
+	/* RFC 3267 octet aligned: CMR, one TOC entry and the core */
+	if (payload_len < 2) {
+		LOGP(DRTP, LOGL_ERROR, "RTP AMR payload length %u < 2\n",
+			payload_len);
+		return -EINVAL;
+	}
+
+	cmr = rtp_payload[0] >> 4;
+	ft = (rtp_payload[1] >> 3) & 0xf;
+
+	/* Codec Mode Request is in upper 4 bits of RTP payload header.
+	 * The peer sends it only when it changes, so remember it */
+	if (cmr != AMR_CMR_NONE) {
+		rc = get_amr_mode_idx(amr_mrc, cmr);
+		if (rc < 0) {
+			LOGP(DRTP, LOGL_INFO, "RTP->L1: overriding CMR %u\n", cmr);
+			rc = amr_mode_idx_at_most(amr_mrc, cmr);
+		}
+		st->dl_cmr = rc;
+		st->dl_cmr_valid = 1;
+	}
+
+	/* a NO_DATA frame may still carry the CMR, but there is
+	 * nothing for the L1 to transmit */
+	if (ft == AMR_FT_NO_DATA)
+		return 0;
+
+	if (ft >= ARRAY_SIZE(amr_ft_bits)) {
+		LOGP(DRTP, LOGL_ERROR, "unsupported AMR FT 0x%02x\n", ft);
+		return -EINVAL;
+	}
+
+	/* the core of the frame type, it must neither end early nor
+	 * overrun the L1 frame */
+	amr_if2_core_len = payload_len - 2;
+	if (amr_if2_core_len != (amr_ft_bits[ft] + 7) / 8) {
+		LOGP(DRTP, LOGL_ERROR, "RTP AMR FT %u core length %u != "
+			"expected %u\n", ft, amr_if2_core_len,
+			(amr_ft_bits[ft] + 7) / 8);
+		return -EINVAL;
+	}
+
+	/* shift everything right one nibble to make space for FT and
+	 * reverse the bit-order within every byte of the IF2 core frame
+	 * contained in the RTP payload */
+	tch_shift_right_rev(l1_payload+2, rtp_payload+2, amr_if2_core_len*2);
 
 	/* CMI in downlink tells the L1 encoder which encoding function
 	 * it will use, so we have to use the frame type */
@@ -328,21 +428,14 @@ static int rtppayload_to_l1_amr(uint8_t *l1_payload, const uint8_t *rtp_payload,
 		*l1_cmi_idx = 0;
 	} else
 		*l1_cmi_idx = rc;
+	st->dl_cmi = *l1_cmi_idx;
+
+	/* command the MS to use the mode the uplink radio conditions
+	 * allow, but none faster than the peer requested */
+	*l1_cmr_idx = st->ul_cmc;
+	if (st->dl_cmr_valid && st->dl_cmr < *l1_cmr_idx)
+		*l1_cmr_idx = st->dl_cmr;
 
-	/* Codec Mode Request is in upper 4 bits of RTP payload header,
-	 * and we simply copy the CMR into the CMC */
-	if (cmr == 0xF) {
-		/* FIXME: we need some state about the last codec mode */
-		*l1_cmr_idx = 0;
-	} else {
-		rc = get_amr_mode_idx(amr_mrc, cmr);
-		if (rc < 0) {
-			/* FIXME: we need some state about the last codec mode */
-			LOGP(DRTP, LOGL_INFO, "RTP->L1: overriding CMR %u\n", cmr);
-			*l1_cmr_idx = 0;
-		} else
-			*l1_cmr_idx = rc;
-	}
 #if 0
 	/* check for bad quality indication */
 	if (rtp_payload[1] & AMR_TOC_QBIT) {
@@ -376,13 +469,114 @@ static int rtppayload_to_l1_amr(uint8_t *l1_payload, const uint8_t *rtp_payload,
 
 #define RTP_MSGB_ALLOC_SIZE	512
 
+/* a voice frame every 20ms */
+#define TCH_FRAME_US		20000
+/* arrival gaps longer than that are a pause (DTX), not jitter */
+#define TCH_JITTER_GAP_MAX_US	200000
+
+static struct tch_dl_ring *lchan_tch_dl_ring(struct gsm_lchan *lchan)
+{
+	struct femtol1_hdl *fl1h = trx_femtol1_hdl(lchan->ts->trx);
+
+	return &fl1h->tch_dl[lchan->ts->nr][lchan->nr];
+}
+
+/* Estimate the jitter of the RTP arrival like RFC 3550 6.4.1 does,
+ * based on the deviation of the time between two frames from 20ms,
+ * and pick the queue depth to cover twice that jitter. */
+static void tch_dl_update_target(struct tch_dl_ring *r)
+{
+	uint32_t now = l1_lat_now();
+	uint32_t delta, d;
+
+	if (r->last_rx_valid) {
+		delta = now - r->last_rx_us;
+		if (delta <= TCH_JITTER_GAP_MAX_US) {
+			if (delta > TCH_FRAME_US)
+				d = delta - TCH_FRAME_US;
+			else
+				d = TCH_FRAME_US - delta;
+			r->jitter += d - ((r->jitter + 8) >> 4);
+		}
+	}
+	r->last_rx_us = now;
+	r->last_rx_valid = 1;
+
+	r->target = 1 + (2 * (r->jitter >> 4) + TCH_FRAME_US - 1) /
+								TCH_FRAME_US;
+	if (r->target > TCH_DL_TARGET_MAX)
+		r->target = TCH_DL_TARGET_MAX;
+}
+
+/* queue a PH-DATA.req for the next TCH PH-RTS.ind of the lchan.  If
+ * there are as many frames as the target depth already, the oldest are
+ * dropped to keep the latency down. */
+static void tch_dl_enqueue(struct gsm_lchan *lchan, struct msgb *msg)
+{
+	struct tch_dl_ring *r = lchan_tch_dl_ring(lchan);
+
+	tch_dl_update_target(r);
+
+	while (r->depth >= r->target) {
+		msgb_free(r->msg[r->head]);
+		r->msg[r->head] = NULL;
+		r->head = (r->head + 1) % TCH_DL_RING_SIZE;
+		r->depth--;
+		r->stats.dropped++;
+	}
+
+	r->msg[(r->head + r->depth) % TCH_DL_RING_SIZE] = msg;
+	r->depth++;
+	r->stats.enqueued++;
+
+	DEBUGP(DL1C, "%s DL TCH queue length = %u (target %u)\n",
+		gsm_lchan_name(lchan), r->depth, r->target);
+}
+
+/*! \brief obtain the next PH-DATA.req queued for the TCH of an lchan
+ *  \returns NULL in case of an underrun */
+struct msgb *tch_dl_dequeue(struct gsm_lchan *lchan)
+{
+	struct tch_dl_ring *r = lchan_tch_dl_ring(lchan);
+	struct msgb *msg;
+
+	if (r->depth == 0) {
+		r->stats.underruns++;
+		return NULL;
+	}
+
+	msg = r->msg[r->head];
+	r->msg[r->head] = NULL;
+	r->head = (r->head + 1) % TCH_DL_RING_SIZE;
+	r->depth--;
+
+	return msg;
+}
+
+/*! \brief drop all frames queued for the TCH of an lchan and forget
+ *  about the jitter of its previous RTP stream */
+void tch_dl_flush(struct gsm_lchan *lchan)
+{
+	struct tch_dl_ring *r = lchan_tch_dl_ring(lchan);
+
+	while (r->depth) {
+		msgb_free(r->msg[r->head]);
+		r->msg[r->head] = NULL;
+		r->head = (r->head + 1) % TCH_DL_RING_SIZE;
+		r->depth--;
+	}
+	r->target = 1;
+	r->jitter = 0;
+	r->last_rx_valid = 0;
+}
+
 /*! \brief call-back function for incoming RTP 
  *  \param rs RTP Socket
  *  \param[in] rtp_pl buffer containing RTP payload
  *  \param[in] rtp_pl_len length of \a rtp_pl
  *
  * This function prepares a msgb with a L1 PH-DATA.req primitive and
- * queues it into lchan->dl_tch_queue.
+ * queues it for the lchan, see tch_dl_enqueue().
  *
  * Note that the actual L1 primitive header is not fully initialized
  * yet, as things like the frame number, etc. are unknown at the time we
@@ -403,7 +597,7 @@ void bts_model_rtp_rx_cb(struct osmo_rtp_socket *rs, const uint8_t *rtp_pl,
 	DEBUGP(DRTP, "%s RTP IN: %s\n", gsm_lchan_name(lchan),
 		osmo_hexdump(rtp_pl, rtp_pl_len));
 
-	msg = l1p_msgb_alloc();
+	msg = l1p_msgb_get(trx_femtol1_hdl(lchan->ts->trx));
 	if (!msg) {
 		LOGP(DRTP, LOGL_ERROR, "%s: Failed to allocate Rx payload.\n",
 			gsm_lchan_name(lchan));
@@ -428,14 +622,14 @@ void bts_model_rtp_rx_cb(struct osmo_rtp_socket *rs, const uint8_t *rtp_pl,
 						 rtp_pl, rtp_pl_len);
 		}
 		break;
-#ifdef GsmL1_TchPlType_Efr
 	case GSM48_CMODE_SPEECH_EFR:
+		if (lchan->type != GSM_LCHAN_TCH_F) {
+			rc = -1;
+			break;
+		}
 		*payload_type = GsmL1_TchPlType_Efr;
-		rc = FIXME;
+		rc = rtppayload_to_l1_efr(l1_payload, rtp_pl, rtp_pl_len);
 		break;
-#else
-#warning No EFR support in L1
-#endif
 	case GSM48_CMODE_SPEECH_AMR:
 		*payload_type = GsmL1_TchPlType_Amr;
 		rc = rtppayload_to_l1_amr(l1_payload, rtp_pl,
@@ -453,33 +647,19 @@ void bts_model_rtp_rx_cb(struct osmo_rtp_socket *rs, const uint8_t *rtp_pl,
 		msgb_free(msg);
 		return;
 	}
+	/* nothing to transmit, e.g. AMR NO_DATA */
+	if (rc == 0) {
+		msgb_free(msg);
+		return;
+	}
 
 	msu_param->u8Size = rc + 1;
 
 	DEBUGP(DRTP, "%s RTP->L1: %s\n", gsm_lchan_name(lchan),
 		osmo_hexdump(msu_param->u8Buffer, msu_param->u8Size));
 
-	/* make sure the number of entries in the dl_tch_queue is never
-	 * more than 3 */
-	{
-		struct msgb *tmp;
-		int count = 0;
-
-		llist_for_each_entry(tmp, &lchan->dl_tch_queue, list)
-			count++;
-
-		DEBUGP(DL1C, "%s DL TCH queue length = %u\n",
-			gsm_lchan_name(lchan), count);
-
-		while (count >= 2) {
-			tmp = msgb_dequeue(&lchan->dl_tch_queue);
-			msgb_free(tmp);
-			count--;
-		}
-	}
-
 	/* enqueue msgb to be transmitted to L1 */
-	msgb_enqueue(&lchan->dl_tch_queue, msg);
+	tch_dl_enqueue(lchan, msg);
 }
 
 /*! \brief receive a traffic L1 primitive for a given lchan */
@@ -490,7 +670,9 @@ int l1if_tch_rx(struct gsm_lchan *lchan, struct msgb *l1p_msg)
 	uint8_t payload_type = data_ind->msgUnitParam.u8Buffer[0];
 	uint8_t *payload = data_ind->msgUnitParam.u8Buffer + 1;
 	uint8_t payload_len;
-	struct msgb *rmsg = NULL;
+	/* the RTP code copies the payload, so the stack will do */
+	uint8_t rtp_pl[RTP_PL_MAX_LEN];
+	int rc = -EINVAL;
 
 	if (data_ind->msgUnitParam.u8Size < 1) {
 		LOGP(DL1C, LOGL_ERROR, "%s Rx Payload size 0\n",
@@ -501,11 +683,7 @@ int l1if_tch_rx(struct gsm_lchan *lchan, struct msgb *l1p_msg)
 
 	switch (payload_type) {
 	case GsmL1_TchPlType_Fr:
-#ifdef GsmL1_TchPlType_Efr
 	case GsmL1_TchPlType_Efr:
-#else
-#warning No EFR support in L1
-#endif
 		if (lchan->type != GSM_LCHAN_TCH_F)
 			goto err_payload_match;
 		break;
@@ -530,32 +708,27 @@ int l1if_tch_rx(struct gsm_lchan *lchan, struct msgb *l1p_msg)
 
 	switch (payload_type) {
 	case GsmL1_TchPlType_Fr:
-		rmsg = l1_to_rtppayload_fr(payload, payload_len);
+		rc = l1_to_rtppayload_fr(rtp_pl, payload, payload_len);
 		break;
 	case GsmL1_TchPlType_Hr:
-		rmsg = l1_to_rtppayload_hr(payload, payload_len);
+		rc = l1_to_rtppayload_hr(rtp_pl, payload, payload_len);
 		break;
-#ifdef GsmL1_TchPlType_Efr
 	case GsmL1_TchPlType_Efr:
-		rmsg = l1_to_rtppayload_efr(payload, payload_len);
+		rc = l1_to_rtppayload_efr(rtp_pl, payload, payload_len);
 		break;
-#else
-#warning No EFR support in L1
-#endif
 	case GsmL1_TchPlType_Amr:
-		rmsg = l1_to_rtppayload_amr(payload, payload_len,
-					    &lchan->tch.amr_mr);
+		rc = l1_to_rtppayload_amr(rtp_pl, payload, payload_len,
+					  lchan);
 		break;
 	}
 
-	if (rmsg) {
+	if (rc > 0) {
 		LOGP(DL1C, LOGL_DEBUG, "%s Rx -> RTP: %s\n",
-			gsm_lchan_name(lchan), osmo_hexdump(rmsg->data, rmsg->len));
-		/* hand rmsg to RTP code for transmission */
+			gsm_lchan_name(lchan), osmo_hexdump(rtp_pl, rc));
+		/* hand the payload to RTP code for transmission */
 		if (lchan->abis_ip.rtp_socket)
 			osmo_rtp_send_frame(lchan->abis_ip.rtp_socket,
-					    rmsg->data, rmsg->len, 160);
-		msgb_free(rmsg);
+					    rtp_pl, rc, 160);
 	}
 
 	return 0;
@@ -576,7 +749,7 @@ struct msgb *gen_empty_tch_msg(struct gsm_lchan *lchan)
 	uint8_t *payload_type;
 	uint8_t *l1_payload;
 
-	msg = l1p_msgb_alloc();
+	msg = l1p_msgb_get(trx_femtol1_hdl(lchan->ts->trx));
 	if (!msg)
 		return NULL;
 
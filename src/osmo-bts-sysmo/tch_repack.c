@@ -0,0 +1,153 @@
+/* Repacking of speech frames between the L1 and the RTP format */
+
+/* (C) 2026 by agent <agent@local>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <errno.h>
+
+#include "tch_repack.h"
+
+/* every octet with its bits in reverse order */
+#define R2(n)	n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n)	R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n)	R4(n), R4(n + 2*4), R4(n + 1*4), R4(n + 3*4)
+
+static const uint8_t flip[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+/* The nibbles of flip[x] are the reversed nibbles of x, swapped.  So
+ * combining nibbles of two neighbouring octets and reversing the result
+ * is the same as combining nibbles of the two reversed octets.  Every
+ * input octet is looked up once and kept for the next output octet. */
+
+void tch_rev_shift_right(uint8_t *out, const uint8_t *in,
+			 unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+	uint8_t prev = flip[in[0]];
+
+	out[0] = prev >> 4;
+
+	for (i = 1; i < num_whole_bytes; i++) {
+		uint8_t cur = flip[in[i]];
+		out[i] = (prev << 4) | (cur >> 4);
+		prev = cur;
+	}
+
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = (prev << 4) | (flip[in[i]] >> 4);
+	else
+		out[i] = prev << 4;
+}
+
+void tch_shift_right_rev(uint8_t *out, const uint8_t *in,
+			 unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+	uint8_t prev = flip[in[0]];
+
+	out[0] = prev << 4;
+
+	for (i = 1; i < num_whole_bytes; i++) {
+		uint8_t cur = flip[in[i]];
+		out[i] = (cur << 4) | (prev >> 4);
+		prev = cur;
+	}
+
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = (flip[in[i]] << 4) | (prev >> 4);
+	else
+		out[i] = prev >> 4;
+}
+
+void tch_rev_shift_left(uint8_t *out, const uint8_t *in,
+			unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+	uint8_t cur = flip[in[0]];
+
+	for (i = 0; i < num_whole_bytes; i++) {
+		uint8_t next = flip[in[i+1]];
+		out[i] = (cur << 4) | (next >> 4);
+		cur = next;
+	}
+
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = cur << 4;
+}
+
+void tch_shift_left_rev(uint8_t *out, const uint8_t *in,
+			unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+	uint8_t cur = flip[in[0]];
+
+	for (i = 0; i < num_whole_bytes; i++) {
+		uint8_t next = flip[in[i+1]];
+		out[i] = (next << 4) | (cur >> 4);
+		cur = next;
+	}
+
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = cur >> 4;
+}
+
+void tch_rev_copy(uint8_t *out, const uint8_t *in, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		out[i] = flip[in[i]];
+}
+
+int tch_l1_to_rtp_efr(uint8_t *rtp_pl, const uint8_t *l1_payload,
+		      unsigned int payload_len)
+{
+	if (payload_len < GSM_EFR_BYTES)
+		return -EINVAL;
+
+	tch_rev_shift_right(rtp_pl, l1_payload, GSM_EFR_BITS/4);
+
+	/* TS 101318 Chapter 5.3: signature 0xC in the first nibble */
+	rtp_pl[0] |= 0xC0;
+
+	return GSM_EFR_BYTES;
+}
+
+int tch_rtp_to_l1_efr(uint8_t *l1_payload, const uint8_t *rtp_payload,
+		      unsigned int payload_len)
+{
+	if (payload_len != GSM_EFR_BYTES)
+		return -EINVAL;
+
+	if ((rtp_payload[0] >> 4) != 0xC)
+		return -EINVAL;
+
+	tch_shift_left_rev(l1_payload, rtp_payload, GSM_EFR_BITS/4);
+
+	return GSM_EFR_BYTES;
+}
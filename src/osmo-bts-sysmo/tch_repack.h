@@ -0,0 +1,47 @@
+#ifndef _TCH_REPACK_H
+#define _TCH_REPACK_H
+
+#include <stdint.h>
+
+/* The L1 transfers speech frames with the bits of every octet in
+ * reverse order, while RTP (TS 101 318, RFC 3267) puts them MSB first
+ * and one nibble further to the right or left.  The functions below do
+ * the bit reversal and the nibble shift in one pass over the frame. */
+
+/* reverse the bits of every octet, then shift right by one nibble
+ * (L1 -> RTP for FR and EFR); fills num_nibbles/2 + 1 octets */
+void tch_rev_shift_right(uint8_t *out, const uint8_t *in,
+			 unsigned int num_nibbles);
+
+/* shift right by one nibble, then reverse the bits of every octet
+ * (RTP -> L1 for AMR); fills num_nibbles/2 + 1 octets */
+void tch_shift_right_rev(uint8_t *out, const uint8_t *in,
+			 unsigned int num_nibbles);
+
+/* reverse the bits of every octet, then shift left by one nibble
+ * (L1 -> RTP for AMR); fills (num_nibbles + 1)/2 octets */
+void tch_rev_shift_left(uint8_t *out, const uint8_t *in,
+			unsigned int num_nibbles);
+
+/* shift left by one nibble, then reverse the bits of every octet
+ * (RTP -> L1 for FR and EFR); fills (num_nibbles + 1)/2 octets */
+void tch_shift_left_rev(uint8_t *out, const uint8_t *in,
+			unsigned int num_nibbles);
+
+/* copy len octets with the bits of every octet reversed (HR) */
+void tch_rev_copy(uint8_t *out, const uint8_t *in, unsigned int len);
+
+#define GSM_EFR_BITS	244
+#define GSM_EFR_BYTES	31	/* TS 101318 Chapter 5.3: 244 bits + 4bit sig */
+
+/* GSM-EFR from the L1 to a RTP payload of GSM_EFR_BYTES, returns its
+ * length or -EINVAL if the L1 frame is too short */
+int tch_l1_to_rtp_efr(uint8_t *rtp_pl, const uint8_t *l1_payload,
+		      unsigned int payload_len);
+
+/* GSM-EFR from a RTP payload to the L1, returns the number of octets
+ * filled or -EINVAL if the payload is not a EFR frame */
+int tch_rtp_to_l1_efr(uint8_t *l1_payload, const uint8_t *rtp_payload,
+		      unsigned int payload_len);
+
+#endif /* _TCH_REPACK_H */
@@ -0,0 +1,370 @@
+/* throughput benchmark of the paging code */
+
+/* (C) 2026 by agent <agent@local>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/gsm/gsm_utils.h>
+#include <osmocom/gsm/protocol/gsm_04_08.h>
+
+#include <osmo-bts/logging.h>
+#include <osmo-bts/paging.h>
+
+/* number of TDMA frames in a hyperframe */
+#define HYPERFRAME	2715648
+
+/* first frame of each of the 9 CCCH blocks of a non-combined CCCH */
+static const uint8_t ccch_block_fn[] = { 6, 12, 16, 22, 26, 32, 36, 42, 46 };
+
+static struct {
+	unsigned long frames;
+	unsigned int rate;		/* offered pagings per second */
+	unsigned int tmsi_percent;
+	unsigned int population;	/* distinct subscribers */
+	unsigned int num_paging_max;
+	unsigned int lifetime;		/* seconds */
+	unsigned int bs_ag_blks_res;
+	unsigned int bs_pa_mfrms;
+	unsigned int seed;
+} cfg = {
+	.frames = HYPERFRAME,
+	.rate = 50,
+	.tmsi_percent = 80,
+	.population = 100000,
+	.num_paging_max = 200,
+	.lifetime = 0,
+	.bs_ag_blks_res = 1,
+	.bs_pa_mfrms = 0,
+	.seed = 1,
+};
+
+static struct {
+	unsigned long offered;
+	unsigned long accepted;
+	unsigned long duplicate;
+	unsigned long dropped;
+	unsigned long ids_sent;
+	unsigned long pch_total;
+	unsigned long pch_used;
+	unsigned long long add_ns;
+	unsigned long long gen_ns;
+	unsigned long long tick_ns;
+	unsigned int max_queue;
+} stats;
+
+static uint32_t rnd_state;
+
+/* xorshift32, so runs are reproducible across C libraries */
+static uint32_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void gen_tmsi_lv(uint8_t *lv, uint32_t sub)
+{
+	lv[0] = 5;
+	lv[1] = 0xF0 | GSM_MI_TYPE_TMSI;
+	memcpy(lv+2, &sub, sizeof(sub));
+}
+
+/* 15 digit IMSI 262420000000000 + sub, returns IMSI mod 1000 */
+static unsigned int gen_imsi_lv(uint8_t *lv, uint32_t sub)
+{
+	uint8_t digits[15] = { 2, 6, 2, 4, 2, 0 };
+	unsigned int i;
+
+	for (i = 14; i >= 6; i--) {
+		digits[i] = sub % 10;
+		sub /= 10;
+	}
+
+	lv[0] = 8;
+	lv[1] = (digits[0] << 4) | GSM_MI_ODD | GSM_MI_TYPE_IMSI;
+	for (i = 0; i < 7; i++)
+		lv[2+i] = digits[1+2*i] | (digits[2+2*i] << 4);
+
+	return digits[12] * 100 + digits[13] * 10 + digits[14];
+}
+
+/* number of identities in a generated PAGING REQUEST */
+static unsigned int count_ids(const uint8_t *msg)
+{
+	unsigned int len = (msg[0] >> 2) + 1;
+
+	switch (msg[2]) {
+	case GSM48_MT_RR_PAG_REQ_3:
+		return 4;
+	case GSM48_MT_RR_PAG_REQ_2:
+		return len > sizeof(struct gsm48_paging2) ? 3 : 2;
+	case GSM48_MT_RR_PAG_REQ_1:
+		return len > sizeof(struct gsm48_paging1) + 1 + msg[4] ? 2 : 1;
+	}
+
+	return 0;
+}
+
+static void offer_paging(struct paging_state *ps, unsigned int num_groups)
+{
+	uint8_t lv[9];
+	uint32_t sub = rnd() % cfg.population;
+	unsigned int group;
+	unsigned long long t;
+	int rc;
+
+	/* the BSC derives the group from the IMSI in both cases */
+	group = gen_imsi_lv(lv, sub) % num_groups;
+	if (rnd() % 100 < cfg.tmsi_percent)
+		gen_tmsi_lv(lv, sub);
+
+	t = now_ns();
+	rc = paging_add_identity(ps, group, lv, 0, 0);
+	stats.add_ns += now_ns() - t;
+
+	stats.offered++;
+	switch (rc) {
+	case 0:
+		stats.accepted++;
+		break;
+	case -EEXIST:
+		stats.duplicate++;
+		break;
+	default:
+		stats.dropped++;
+		break;
+	}
+}
+
+static void run(struct paging_state *ps, unsigned int num_groups)
+{
+	uint8_t out_buf[GSM_MACBLOCK_LEN];
+	struct gsm_time g_time;
+	/* pagings per frame, in units of 1/26000 */
+	unsigned long long credit = 0;
+	unsigned long fn;
+	unsigned long long t;
+	unsigned int i, len;
+	int rc, is_empty;
+
+	for (fn = 0; fn < cfg.frames; fn++) {
+		uint32_t tdma_fn = fn % HYPERFRAME;
+
+		t = now_ns();
+		paging_fn_tick(ps, tdma_fn);
+		stats.tick_ns += now_ns() - t;
+
+		/* one frame lasts 120/26 ms */
+		credit += cfg.rate * 120ULL;
+		while (credit >= 26000) {
+			credit -= 26000;
+			offer_paging(ps, num_groups);
+		}
+
+		len = paging_queue_length(ps);
+		if (len > stats.max_queue)
+			stats.max_queue = len;
+
+		for (i = 0; i < sizeof(ccch_block_fn); i++) {
+			if (tdma_fn % 51 == ccch_block_fn[i])
+				break;
+		}
+		/* not the start of a CCCH block, or an AGCH block */
+		if (i == sizeof(ccch_block_fn) || i < cfg.bs_ag_blks_res)
+			continue;
+
+		gsm_fn2gsmtime(&g_time, tdma_fn);
+		t = now_ns();
+		rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+		stats.gen_ns += now_ns() - t;
+		if (rc < 0)
+			continue;
+
+		stats.pch_total++;
+		if (!is_empty) {
+			stats.pch_used++;
+			stats.ids_sent += count_ids(out_buf);
+		}
+	}
+}
+
+static void print_help(void)
+{
+	printf(	"Usage: paging_bench [options]\n"
+		"  -f --frames N          Number of TDMA frames to simulate\n"
+		"  -r --rate N            Offered pagings per second\n"
+		"  -t --tmsi-percent N    Share of pagings by TMSI\n"
+		"  -p --population N      Number of distinct subscribers\n"
+		"  -n --num-paging-max N  Size of the paging record pool\n"
+		"  -l --lifetime N        Paging lifetime in seconds\n"
+		"  -a --bs-ag-blks-res N  CCCH blocks reserved for AGCH\n"
+		"  -m --bs-pa-mfrms N     BS_PA_MFRMS as coded in SI3 (0..7)\n"
+		"  -s --seed N            Seed of the random generator\n");
+}
+
+static void handle_options(int argc, char **argv)
+{
+	while (1) {
+		int option_idx = 0, c;
+		static const struct option long_options[] = {
+			{ "help", 0, 0, 'h' },
+			{ "frames", 1, 0, 'f' },
+			{ "rate", 1, 0, 'r' },
+			{ "tmsi-percent", 1, 0, 't' },
+			{ "population", 1, 0, 'p' },
+			{ "num-paging-max", 1, 0, 'n' },
+			{ "lifetime", 1, 0, 'l' },
+			{ "bs-ag-blks-res", 1, 0, 'a' },
+			{ "bs-pa-mfrms", 1, 0, 'm' },
+			{ "seed", 1, 0, 's' },
+			{ 0, 0, 0, 0 }
+		};
+
+		c = getopt_long(argc, argv, "hf:r:t:p:n:l:a:m:s:",
+				long_options, &option_idx);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'h':
+			print_help();
+			exit(0);
+		case 'f':
+			cfg.frames = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			cfg.rate = atoi(optarg);
+			break;
+		case 't':
+			cfg.tmsi_percent = atoi(optarg);
+			break;
+		case 'p':
+			cfg.population = atoi(optarg);
+			break;
+		case 'n':
+			cfg.num_paging_max = atoi(optarg);
+			break;
+		case 'l':
+			cfg.lifetime = atoi(optarg);
+			break;
+		case 'a':
+			cfg.bs_ag_blks_res = atoi(optarg);
+			break;
+		case 'm':
+			cfg.bs_pa_mfrms = atoi(optarg);
+			break;
+		case 's':
+			cfg.seed = atoi(optarg);
+			break;
+		default:
+			print_help();
+			exit(2);
+		}
+	}
+
+	if (cfg.population == 0 || cfg.bs_ag_blks_res > 7 ||
+	    cfg.bs_pa_mfrms > 7 || cfg.seed == 0) {
+		fprintf(stderr, "Invalid option value\n");
+		exit(2);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct gsm48_control_channel_descr chan_desc;
+	struct paging_state *ps;
+	struct rusage ru;
+	unsigned long long t;
+	unsigned int num_groups;
+	double wall_s, sim_s;
+	void *ctx;
+
+	handle_options(argc, argv);
+	rnd_state = cfg.seed;
+
+	ctx = talloc_named_const(NULL, 1, "paging_bench");
+
+	/* the per-paging log lines would dominate the measurement */
+	bts_log_init(NULL);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
+	ps = paging_init(ctx, cfg.num_paging_max, cfg.lifetime);
+	if (!ps) {
+		fprintf(stderr, "Unable to initialize paging\n");
+		return 1;
+	}
+
+	memset(&chan_desc, 0, sizeof(chan_desc));
+	chan_desc.bs_ag_blks_res = cfg.bs_ag_blks_res;
+	chan_desc.bs_pa_mfrms = cfg.bs_pa_mfrms;
+	paging_si_update(ps, &chan_desc);
+	num_groups = (9 - cfg.bs_ag_blks_res) * (cfg.bs_pa_mfrms + 2);
+
+	t = now_ns();
+	run(ps, num_groups);
+	wall_s = (now_ns() - t) / 1e9;
+	sim_s = cfg.frames * 120.0 / 26000.0;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("frames:          %lu (%.1f s of air time)\n", cfg.frames, sim_s);
+	printf("offered:         %lu (%.1f/s)\n", stats.offered,
+		stats.offered / sim_s);
+	printf("accepted:        %lu, duplicate: %lu, dropped: %lu\n",
+		stats.accepted, stats.duplicate, stats.dropped);
+	printf("expired:         %u, max queue: %u of %u\n",
+		paging_expired_count(ps), stats.max_queue, cfg.num_paging_max);
+	printf("identities sent: %lu (%.1f/s air time)\n", stats.ids_sent,
+		stats.ids_sent / sim_s);
+	printf("PCH utilisation: %.1f%% (%lu of %lu blocks)\n",
+		stats.pch_total ? 100.0 * stats.pch_used / stats.pch_total : 0,
+		stats.pch_used, stats.pch_total);
+	printf("add_identity:    %.1f ns/call\n",
+		stats.offered ? (double) stats.add_ns / stats.offered : 0);
+	printf("gen_msg:         %.1f ns/call\n",
+		stats.pch_total ? (double) stats.gen_ns / stats.pch_total : 0);
+	printf("fn_tick:         %.1f ns/call\n",
+		cfg.frames ? (double) stats.tick_ns / cfg.frames : 0);
+	printf("throughput:      %.0f pages/s wall clock (%.2f s)\n",
+		wall_s > 0 ? stats.offered / wall_s : 0, wall_s);
+	printf("paging state:    %zu bytes, peak RSS %ld KiB\n",
+		talloc_total_size(ps), ru.ru_maxrss);
+
+	talloc_free(ctx);
+
+	return 0;
+}
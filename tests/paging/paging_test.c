@@ -18,7 +18,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
 #include <osmocom/core/talloc.h>
+#include <osmocom/gsm/protocol/gsm_08_58.h>
 
 #include <osmo-bts/bts.h>
 #include <osmo-bts/logging.h>
@@ -41,31 +46,461 @@ static const uint8_t static_ilv[] = {
 
 static void test_paging_smoke(void)
 {
-	int rc;
+	int rc, is_empty;
 	uint8_t out_buf[GSM_MACBLOCK_LEN];
 	struct gsm_time g_time;
 	printf("Testing that paging messages expire.\n");
 
 	/* add paging entry */
-	rc = paging_add_identity(btsb->paging_state, 0, static_ilv, 0);
+	rc = paging_add_identity(btsb->paging_state, 0, static_ilv, 0, 0);
 	ASSERT_TRUE(rc == 0);
 	ASSERT_TRUE(paging_queue_length(btsb->paging_state) == 1);
+	ASSERT_TRUE(paging_buffer_space(btsb->paging_state) == 199);
 
 	/* generate messages */
-	g_time.fn = 0;
+	g_time.fn = 6;
 	g_time.t1 = 0;
 	g_time.t2 = 0;
 	g_time.t3 = 6;
-	rc = paging_gen_msg(btsb->paging_state, out_buf, &g_time);
+	rc = paging_gen_msg(btsb->paging_state, out_buf, &g_time, &is_empty);
 	ASSERT_TRUE(rc == 13);
+	ASSERT_TRUE(!is_empty);
 
 	ASSERT_TRUE(paging_group_queue_empty(btsb->paging_state, 0));
 	ASSERT_TRUE(paging_queue_length(btsb->paging_state) == 0);
+	ASSERT_TRUE(paging_buffer_space(btsb->paging_state) == 200);
+
+	/* nothing left to page */
+	rc = paging_gen_msg(btsb->paging_state, out_buf, &g_time, &is_empty);
+	ASSERT_TRUE(rc > 0);
+	ASSERT_TRUE(is_empty);
+}
+
+#define MAX_MIX	9
+
+static void gen_tmsi_lv(uint8_t *lv, unsigned int n)
+{
+	lv[0] = 5;
+	lv[1] = 0xF4;
+	lv[2] = 0x10;
+	lv[3] = 0x20;
+	lv[4] = 0x30;
+	lv[5] = n;
+}
+
+static void gen_imsi_lv(uint8_t *lv, unsigned int n)
+{
+	memcpy(lv, static_ilv, sizeof(static_ilv));
+	lv[8] = n;
+}
+
+/* minimum number of PCH blocks for t TMSIs and i IMSIs, computed by
+ * trying every possible content of Paging Request Type 1/2/3 */
+static unsigned int min_blocks(unsigned int t, unsigned int i)
+{
+	static unsigned int memo[MAX_MIX+1][MAX_MIX+1];
+	unsigned int best = UINT_MAX, n;
+
+	if (t + i == 0)
+		return 0;
+	if (memo[t][i])
+		return memo[t][i];
+
+#define TRY(tt, ii) do {				\
+		n = 1 + min_blocks(tt, ii);		\
+		if (n < best)				\
+			best = n;			\
+	} while (0)
+
+	/* Type 3: 4 TMSI */
+	if (t >= 4)
+		TRY(t - 4, i);
+	/* Type 2: 2 TMSI + any */
+	if (t >= 3)
+		TRY(t - 3, i);
+	if (t >= 2 && i >= 1)
+		TRY(t - 2, i - 1);
+	/* Type 1: any two, or a single one */
+	if (t >= 2)
+		TRY(t - 2, i);
+	if (t >= 1 && i >= 1)
+		TRY(t - 1, i - 1);
+	if (i >= 2)
+		TRY(t, i - 2);
+	if (t + i == 1)
+		TRY(0, 0);
+#undef TRY
+
+	memo[t][i] = best;
+	return best;
+}
+
+static void test_paging_packing(void)
+{
+	struct gsm_time g_time = { .fn = 6, .t3 = 6 };
+	uint8_t out_buf[GSM_MACBLOCK_LEN];
+	uint8_t lv[9];
+	unsigned int t, i, n;
+	int is_empty;
+	printf("Testing optimal packing of TMSI/IMSI mixes.\n");
+
+	for (t = 0; t <= MAX_MIX; t++) {
+		for (i = 0; i <= MAX_MIX; i++) {
+			struct paging_state *ps;
+			unsigned int blocks = 0, max_first;
+			int len, before, sent;
+
+			ps = paging_init(tall_bts_ctx, 2 * MAX_MIX, 0);
+			ASSERT_TRUE(ps);
+			for (n = 0; n < t; n++) {
+				gen_tmsi_lv(lv, n);
+				ASSERT_TRUE(paging_add_identity(ps, 0, lv, 0, 0) == 0);
+			}
+			for (n = 0; n < i; n++) {
+				gen_imsi_lv(lv, n);
+				ASSERT_TRUE(paging_add_identity(ps, 0, lv, 0, 0) == 0);
+			}
+
+			/* the first block must carry as many as possible */
+			if (t >= 4)
+				max_first = 4;
+			else if (t >= 2 && t + i >= 3)
+				max_first = 3;
+			else
+				max_first = t + i < 2 ? t + i : 2;
+
+			while (!paging_group_queue_empty(ps, 0)) {
+				before = paging_queue_length(ps);
+				len = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+				ASSERT_TRUE(len > 0 && len <= GSM_MACBLOCK_LEN);
+				sent = before - paging_queue_length(ps);
+				switch (out_buf[2]) {
+				case GSM48_MT_RR_PAG_REQ_3:
+					ASSERT_TRUE(sent == 4);
+					ASSERT_TRUE(len == 20);
+					break;
+				case GSM48_MT_RR_PAG_REQ_2:
+					ASSERT_TRUE(sent == 3);
+					break;
+				default:
+					ASSERT_TRUE(out_buf[2] == GSM48_MT_RR_PAG_REQ_1);
+					ASSERT_TRUE(sent == 1 || sent == 2);
+					break;
+				}
+				/* L2 pseudo length, without the rest octets */
+				ASSERT_TRUE(out_buf[0] == (((len - 1) << 2) | 0x01));
+				if (blocks == 0)
+					ASSERT_TRUE(sent == max_first);
+				blocks++;
+			}
+
+			ASSERT_TRUE(blocks == min_blocks(t, i));
+			talloc_free(ps);
+		}
+	}
+}
+
+/* an IMSI must not starve in a group that always has 4 TMSIs for a
+ * PAGING REQUEST TYPE 3 */
+static void test_paging_tmsi_stream(void)
+{
+	struct gsm_time g_time = { .fn = 6, .t3 = 6 };
+	uint8_t out_buf[GSM_MACBLOCK_LEN];
+	uint8_t lv[9];
+	struct paging_state *ps;
+	unsigned int blocks, n, tmsi = 0;
+	int is_empty;
+
+	printf("Testing an IMSI in a stream of TMSIs.\n");
+
+	ps = paging_init(tall_bts_ctx, 16, 0);
+	ASSERT_TRUE(ps);
+
+	gen_imsi_lv(lv, 0);
+	ASSERT_TRUE(paging_add_identity(ps, 0, lv, 0, 0) == 0);
+
+	for (blocks = 0; blocks < 10; blocks++) {
+		for (n = 0; n < 4; n++) {
+			gen_tmsi_lv(lv, tmsi++);
+			ASSERT_TRUE(paging_add_identity(ps, 0, lv, 0, 0) == 0);
+		}
+		ASSERT_TRUE(paging_gen_msg(ps, out_buf, &g_time, &is_empty) > 0);
+		if (out_buf[2] != GSM48_MT_RR_PAG_REQ_3)
+			break;
+	}
+
+	/* TYPE 3 first, but the IMSI goes out after a few blocks */
+	printf("IMSI sent in block %u\n", blocks);
+	ASSERT_TRUE(blocks > 0 && blocks <= 4);
+	ASSERT_TRUE(out_buf[2] == GSM48_MT_RR_PAG_REQ_2);
+
+	talloc_free(ps);
+}
+
+static void test_paging_sched_comb(void)
+{
+	struct gsm48_control_channel_descr chan_desc;
+	static const struct {
+		uint32_t fn;
+		int group;
+	} sched[] = {
+		{ 6, -1 },	/* B0 reserved for AGCH */
+		{ 12, 0 },
+		{ 16, 1 },
+		{ 22, -1 },	/* SDCCH/4 */
+		{ 42, -1 },	/* SACCH/4 */
+		{ 51 + 12, 2 },
+		{ 51 + 16, 3 },
+		{ 102 + 12, 0 },
+	};
+	struct paging_state *ps;
+	uint8_t out_buf[GSM_MACBLOCK_LEN];
+	struct gsm_time g_time;
+	unsigned int i;
+	int rc, is_empty;
+	printf("Testing the paging schedule of a combined CCCH.\n");
+
+	ps = paging_init(tall_bts_ctx, 10, 0);
+	ASSERT_TRUE(ps);
+
+	memset(&chan_desc, 0, sizeof(chan_desc));
+	chan_desc.ccch_conf = RSL_BCCH_CCCH_CONF_1_C;
+	chan_desc.bs_ag_blks_res = 1;
+	chan_desc.bs_pa_mfrms = 0;
+	paging_si_update(ps, &chan_desc);
+
+	for (i = 0; i < ARRAY_SIZE(sched); i++) {
+		gsm_fn2gsmtime(&g_time, sched[i].fn);
+		if (sched[i].group < 0) {
+			rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+			ASSERT_TRUE(rc < 0);
+			continue;
+		}
+		rc = paging_add_identity(ps, sched[i].group, static_ilv, 0, 0);
+		ASSERT_TRUE(rc == 0);
+		rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+		ASSERT_TRUE(rc == 13);
+		ASSERT_TRUE(paging_queue_length(ps) == 0);
+	}
+
+	talloc_free(ps);
+}
+
+static void test_paging_expiry(void)
+{
+	struct paging_state *ps;
+	uint32_t fn;
+	int rc;
+	printf("Testing that stale paging records are expired.\n");
+
+	/* 2 seconds lifetime is 9 multiframes */
+	ps = paging_init(tall_bts_ctx, 10, 2);
+	ASSERT_TRUE(ps);
+	paging_fn_tick(ps, 0);
+
+	rc = paging_add_identity(ps, 3, static_ilv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+	ASSERT_TRUE(paging_queue_length(ps) == 1);
+
+	/* the minimum lifetime of an un-sent record is 18 multiframes */
+	for (fn = 0; fn < 17 * 51; fn++)
+		paging_fn_tick(ps, fn);
+	ASSERT_TRUE(paging_queue_length(ps) == 1);
+	ASSERT_TRUE(paging_expired_count(ps) == 0);
+
+	/* refresh through a duplicate, then let it expire */
+	rc = paging_add_identity(ps, 3, static_ilv, 0, 0);
+	ASSERT_TRUE(rc == -EEXIST);
+	for (; fn < 34 * 51; fn++)
+		paging_fn_tick(ps, fn);
+	ASSERT_TRUE(paging_queue_length(ps) == 1);
+	paging_fn_tick(ps, 34 * 51);
+	ASSERT_TRUE(paging_queue_length(ps) == 0);
+	ASSERT_TRUE(paging_group_queue_empty(ps, 3));
+	ASSERT_TRUE(paging_expired_count(ps) == 1);
+
+	talloc_free(ps);
+}
+
+static void test_paging_migrate(void)
+{
+	struct gsm48_control_channel_descr chan_desc;
+	struct paging_state *ps;
+	uint8_t tmsi_lv[6], imsi_lv[9];
+	int rc;
+	printf("Testing the migration of paging records to new groups.\n");
+
+	ps = paging_init(tall_bts_ctx, 10, 0);
+	ASSERT_TRUE(ps);
+
+	/* 9 paging blocks in 2 multiframes: 18 groups */
+	rc = paging_add_identity(ps, 17, static_ilv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+	gen_tmsi_lv(tmsi_lv, 1);
+	rc = paging_add_identity(ps, 17, tmsi_lv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+	gen_imsi_lv(imsi_lv, 0x29);
+	rc = paging_add_identity(ps, 5, imsi_lv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+
+	/* 7 paging blocks in 2 multiframes: 14 groups */
+	memset(&chan_desc, 0, sizeof(chan_desc));
+	chan_desc.bs_ag_blks_res = 2;
+	paging_si_update(ps, &chan_desc);
+	ASSERT_TRUE(paging_queue_length(ps) == 3);
+	ASSERT_TRUE(paging_group_queue_empty(ps, 17));
+	ASSERT_TRUE(paging_group_queue_empty(ps, 5));
+
+	/* the BSC re-sends a paging with the new group (IMSI 092) */
+	rc = paging_add_identity(ps, 8, imsi_lv, 0, 0);
+	ASSERT_TRUE(rc == -EEXIST);
+	ASSERT_TRUE(!paging_group_queue_empty(ps, 8));
+
+	/* IMSI 091 goes to group 91 % 14, the TMSI waits for the BSC */
+	paging_fn_tick(ps, 0);
+	ASSERT_TRUE(paging_queue_length(ps) == 3);
+	ASSERT_TRUE(!paging_group_queue_empty(ps, 7));
+	ASSERT_TRUE(paging_group_queue_empty(ps, 3));
+	ASSERT_TRUE(paging_group_queue_empty(ps, 17));
+
+	/* until the BSC re-sends it with its new group */
+	rc = paging_add_identity(ps, 9, tmsi_lv, 0, 0);
+	ASSERT_TRUE(rc == -EEXIST);
+	ASSERT_TRUE(!paging_group_queue_empty(ps, 9));
+	ASSERT_TRUE(paging_queue_length(ps) == 3);
+
+	/* group beyond the new range is folded into it */
+	gen_tmsi_lv(tmsi_lv, 2);
+	rc = paging_add_identity(ps, 16, tmsi_lv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+	ASSERT_TRUE(!paging_group_queue_empty(ps, 2));
+
+	paging_reset(ps);
+	ASSERT_TRUE(paging_queue_length(ps) == 0);
+	talloc_free(ps);
+}
+
+static void test_paging_prio(void)
+{
+	struct paging_state *ps;
+	uint8_t out_buf[GSM_MACBLOCK_LEN];
+	struct gsm_time g_time;
+	uint8_t lv[9];
+	unsigned int i;
+	int rc, is_empty;
+	printf("Testing eMLPP priority and preemption.\n");
+
+	ps = paging_init(tall_bts_ctx, 10, 0);
+	ASSERT_TRUE(ps);
+
+	/* a level A IMSI behind 8 normal TMSIs is sent right away */
+	for (i = 0; i < 8; i++) {
+		gen_tmsi_lv(lv, i);
+		rc = paging_add_identity(ps, 0, lv, 0, 0);
+		ASSERT_TRUE(rc == 0);
+	}
+	rc = paging_add_identity(ps, 0, static_ilv, 0, 7);
+	ASSERT_TRUE(rc == 0);
+
+	gsm_fn2gsmtime(&g_time, 6);
+	rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+	ASSERT_TRUE(rc > 0);
+	ASSERT_TRUE(out_buf[2] == GSM48_MT_RR_PAG_REQ_2);
+	ASSERT_TRUE(paging_queue_length(ps) == 6);
+	rc = paging_add_identity(ps, 0, static_ilv, 0, 7);
+	ASSERT_TRUE(rc == 0);
+
+	/* the queue is full now, only higher priorities get in */
+	gen_tmsi_lv(lv, 8);
+	rc = paging_add_identity(ps, 1, lv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+	gen_tmsi_lv(lv, 9);
+	rc = paging_add_identity(ps, 1, lv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+	gen_tmsi_lv(lv, 10);
+	rc = paging_add_identity(ps, 1, lv, 0, 0);
+	ASSERT_TRUE(rc == 0);
+	ASSERT_TRUE(paging_queue_length(ps) == 10);
+	ASSERT_TRUE(paging_buffer_space(ps) == 0);
+	gen_tmsi_lv(lv, 11);
+	rc = paging_add_identity(ps, 1, lv, 0, 0);
+	ASSERT_TRUE(rc == -ENOSPC);
+	rc = paging_add_identity(ps, 1, lv, 0, 3);
+	ASSERT_TRUE(rc == 0);
+	ASSERT_TRUE(paging_queue_length(ps) == 10);
+	ASSERT_TRUE(paging_preempted_count(ps) == 1);
+
+	/* the oldest normal records are the victims */
+	gen_tmsi_lv(lv, 0);
+	rc = paging_add_identity(ps, 0, lv, 0, 7);
+	ASSERT_TRUE(rc == 0);
+	ASSERT_TRUE(paging_preempted_count(ps) == 2);
+	gen_tmsi_lv(lv, 2);
+	rc = paging_add_identity(ps, 0, lv, 0, 0);
+	ASSERT_TRUE(rc == -EEXIST);
+
+	paging_reset(ps);
+	ASSERT_TRUE(paging_queue_length(ps) == 0);
+	talloc_free(ps);
+}
+
+static void test_paging_rest_octets(void)
+{
+	static const uint8_t empty_block[GSM_MACBLOCK_LEN] = {
+		0x15, 0x06, 0x21, 0x00, 0x01, 0xF0, 0x2B, 0x2B,
+		0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
+		0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
+	};
+	struct paging_state *ps;
+	uint8_t out_buf[GSM_MACBLOCK_LEN];
+	struct gsm_time g_time;
+	uint8_t lv[9];
+	unsigned int i;
+	int rc, is_empty;
+	printf("Testing the P1/P2/P3 rest octets.\n");
+
+	ps = paging_init(tall_bts_ctx, 10, 0);
+	ASSERT_TRUE(ps);
+	gsm_fn2gsmtime(&g_time, 6);
+
+	rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+	ASSERT_TRUE(rc == 6 && is_empty);
+	ASSERT_TRUE(!memcmp(out_buf, empty_block, GSM_MACBLOCK_LEN));
+
+	/* P1: NLN absent, Priority 1 = level A, Priority 2 absent */
+	rc = paging_add_identity(ps, 0, static_ilv, 0, 7);
+	ASSERT_TRUE(rc == 0);
+	rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+	ASSERT_TRUE(rc == 13 && !is_empty);
+	ASSERT_TRUE(out_buf[13] == 0x7B);
+	for (i = 14; i < GSM_MACBLOCK_LEN; i++)
+		ASSERT_TRUE(out_buf[i] == 0x2B);
+
+	/* P2: Mobile Identity 3 is a TLV, no rest octets needed */
+	gen_tmsi_lv(lv, 1);
+	paging_add_identity(ps, 0, lv, 0, 0);
+	gen_tmsi_lv(lv, 2);
+	paging_add_identity(ps, 0, lv, 0, 0);
+	paging_add_identity(ps, 0, static_ilv, 0, 0);
+	rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+	ASSERT_TRUE(rc == 22);
+	ASSERT_TRUE(out_buf[2] == GSM48_MT_RR_PAG_REQ_2);
+	ASSERT_TRUE(out_buf[12] == GSM48_IE_MOBILE_ID && out_buf[13] == 8);
+	ASSERT_TRUE(out_buf[22] == 0x2B);
+
+	/* P3: CN3 and CN4 = TCH/F, then NLN and 4 priorities absent */
+	for (i = 0; i < 4; i++) {
+		gen_tmsi_lv(lv, i);
+		paging_add_identity(ps, 0, lv, 2, 0);
+	}
+	rc = paging_gen_msg(ps, out_buf, &g_time, &is_empty);
+	ASSERT_TRUE(rc == 20);
+	ASSERT_TRUE(out_buf[0] == 0x4D);
+	ASSERT_TRUE(out_buf[2] == GSM48_MT_RR_PAG_REQ_3);
+	ASSERT_TRUE(out_buf[20] == 0xD3);
+	ASSERT_TRUE(out_buf[21] == 0x2B && out_buf[22] == 0x2B);
 
-	/*
-	 * TODO: test all the cases of different amount tmsi/imsi and check
-	 * if we fill the slots in a optimal way.
-	 */
+	talloc_free(ps);
 }
 
 int main(int argc, char **argv)
@@ -86,6 +521,13 @@ int main(int argc, char **argv)
 
 	btsb = bts_role_bts(bts);
 	test_paging_smoke();
+	test_paging_packing();
+	test_paging_tmsi_stream();
+	test_paging_sched_comb();
+	test_paging_expiry();
+	test_paging_migrate();
+	test_paging_prio();
+	test_paging_rest_octets();
 	printf("Success\n");
 
 	return 0;
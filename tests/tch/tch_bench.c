@@ -0,0 +1,252 @@
+/* benchmark of the repacking of speech frames between L1 and RTP */
+
+/* (C) 2026 by agent <agent@local>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <osmocom/core/bits.h>
+#include <osmocom/core/utils.h>
+
+#include "tch_repack.h"
+
+static struct {
+	unsigned long iterations;
+} cfg = {
+	.iterations = 1000000,
+};
+
+/* nibbles of the frames, as converted by tch.c */
+#define FR_NIBBLES		(260/4)
+#define EFR_NIBBLES		(244/4)
+#define HR_BYTES		14
+#define AMR_122_L1_NIBBLES	(((244 + 4 + 7) / 8) * 2 - 1)
+#define AMR_122_RTP_NIBBLES	(((244 + 7) / 8) * 2)
+
+/* keeps the compiler from optimizing the loops away */
+static volatile uint8_t sink;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint8_t in[64], out[64];
+
+/* the two pass nibble shifts the tch_repack.h functions replace, as
+ * a reference */
+
+/* input octet-aligned, output not octet-aligned */
+static void osmo_nibble_shift_right(uint8_t *out, const uint8_t *in,
+				    unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+
+	/* first byte: upper nibble empty, lower nibble from src */
+	out[0] = (in[0] >> 4);
+
+	/* bytes 1.. */
+	for (i = 1; i < num_whole_bytes; i++)
+		out[i] = ((in[i-1] & 0xF) << 4) | (in[i] >> 4);
+
+	/* shift the last nibble, in case there's an odd count */
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = ((in[i-1] & 0xF) << 4) | (in[i] >> 4);
+	else
+		out[i] = (in[i-1] & 0xF) << 4;
+}
+
+/* input unaligned, output octet-aligned */
+static void osmo_nibble_shift_left_unal(uint8_t *out, const uint8_t *in,
+					unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+
+	for (i = 0; i < num_whole_bytes; i++)
+		out[i] = ((in[i] & 0xF) << 4) | (in[i+1] >> 4);
+
+	/* shift the last nibble, in case there's an odd count */
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = (in[i] & 0xF) << 4;
+}
+
+/* the two pass conversions tch.c used before */
+static void ref_fr_l1_to_rtp(void)
+{
+	osmo_revbytebits_buf(in, FR_NIBBLES/2 + 1);
+	osmo_nibble_shift_right(out, in, FR_NIBBLES);
+}
+
+static void ref_fr_rtp_to_l1(void)
+{
+	osmo_nibble_shift_left_unal(out, in, FR_NIBBLES);
+	osmo_revbytebits_buf(out, (FR_NIBBLES + 1)/2);
+}
+
+static void ref_efr_l1_to_rtp(void)
+{
+	osmo_revbytebits_buf(in, EFR_NIBBLES/2 + 1);
+	osmo_nibble_shift_right(out, in, EFR_NIBBLES);
+}
+
+static void ref_hr(void)
+{
+	memcpy(out, in, HR_BYTES);
+	osmo_revbytebits_buf(out, HR_BYTES);
+}
+
+static void ref_amr_l1_to_rtp(void)
+{
+	osmo_revbytebits_buf(in, AMR_122_L1_NIBBLES/2 + 1);
+	osmo_nibble_shift_left_unal(out, in, AMR_122_L1_NIBBLES);
+}
+
+static void ref_amr_rtp_to_l1(void)
+{
+	osmo_nibble_shift_right(out, in, AMR_122_RTP_NIBBLES);
+	osmo_revbytebits_buf(out, AMR_122_RTP_NIBBLES/2 + 1);
+}
+
+static void fr_l1_to_rtp(void)
+{
+	tch_rev_shift_right(out, in, FR_NIBBLES);
+}
+
+static void fr_rtp_to_l1(void)
+{
+	tch_shift_left_rev(out, in, FR_NIBBLES);
+}
+
+static void efr_l1_to_rtp(void)
+{
+	tch_rev_shift_right(out, in, EFR_NIBBLES);
+}
+
+static void hr(void)
+{
+	tch_rev_copy(out, in, HR_BYTES);
+}
+
+static void amr_l1_to_rtp(void)
+{
+	tch_rev_shift_left(out, in, AMR_122_L1_NIBBLES);
+}
+
+static void amr_rtp_to_l1(void)
+{
+	tch_shift_right_rev(out, in, AMR_122_RTP_NIBBLES);
+}
+
+static const struct {
+	const char *name;
+	void (*ref)(void);
+	void (*fused)(void);
+} benchmarks[] = {
+	{ "FR L1->RTP", ref_fr_l1_to_rtp, fr_l1_to_rtp },
+	{ "FR RTP->L1", ref_fr_rtp_to_l1, fr_rtp_to_l1 },
+	{ "EFR L1->RTP", ref_efr_l1_to_rtp, efr_l1_to_rtp },
+	{ "HR", ref_hr, hr },
+	{ "AMR 12.2 L1->RTP", ref_amr_l1_to_rtp, amr_l1_to_rtp },
+	{ "AMR 12.2 RTP->L1", ref_amr_rtp_to_l1, amr_rtp_to_l1 },
+};
+
+static double run(void (*fn)(void))
+{
+	unsigned long long t;
+	unsigned long i;
+
+	t = now_ns();
+	for (i = 0; i < cfg.iterations; i++) {
+		in[i % sizeof(in)] = i;
+		fn();
+		sink = out[0];
+	}
+
+	return (double) (now_ns() - t) / cfg.iterations;
+}
+
+static void print_help(void)
+{
+	printf("Usage: tch_bench [options]\n");
+	printf("  -h --help		this text\n");
+	printf("  -n --iterations NUM	frames to convert per function "
+		"(default %lu)\n", cfg.iterations);
+}
+
+static void handle_options(int argc, char **argv)
+{
+	while (1) {
+		int option_idx = 0, c;
+		static const struct option long_options[] = {
+			{ "help", 0, 0, 'h' },
+			{ "iterations", 1, 0, 'n' },
+			{ 0, 0, 0, 0 }
+		};
+
+		c = getopt_long(argc, argv, "hn:",
+				long_options, &option_idx);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'h':
+			print_help();
+			exit(0);
+		case 'n':
+			cfg.iterations = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			print_help();
+			exit(2);
+		}
+	}
+
+	if (cfg.iterations == 0) {
+		fprintf(stderr, "Invalid option value\n");
+		exit(2);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	handle_options(argc, argv);
+
+	printf("%-18s %10s %10s\n", "", "two pass", "fused");
+	for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		double ref_ns = run(benchmarks[i].ref);
+		double fused_ns = run(benchmarks[i].fused);
+
+		printf("%-18s %7.1f ns %7.1f ns\n", benchmarks[i].name,
+			ref_ns, fused_ns);
+	}
+
+	return 0;
+}
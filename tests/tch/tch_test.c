@@ -0,0 +1,315 @@
+/* testing the repacking of speech frames between L1 and RTP */
+
+/* (C) 2026 by agent <agent@local>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <osmocom/core/bits.h>
+#include <osmocom/core/utils.h>
+
+#include "tch_repack.h"
+
+#define ASSERT_TRUE(rc) \
+	if (!(rc)) { \
+		printf("Assert failed in %s:%d.\n",  \
+		       __FILE__, __LINE__);          \
+		abort();			     \
+	}
+
+#define NUM_RANDOM_FRAMES	1000
+
+/* the two pass nibble shifts the tch_repack.h functions replace, as
+ * a reference */
+
+/* input octet-aligned, output not octet-aligned */
+static void osmo_nibble_shift_right(uint8_t *out, const uint8_t *in,
+				    unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+
+	/* first byte: upper nibble empty, lower nibble from src */
+	out[0] = (in[0] >> 4);
+
+	/* bytes 1.. */
+	for (i = 1; i < num_whole_bytes; i++)
+		out[i] = ((in[i-1] & 0xF) << 4) | (in[i] >> 4);
+
+	/* shift the last nibble, in case there's an odd count */
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = ((in[i-1] & 0xF) << 4) | (in[i] >> 4);
+	else
+		out[i] = (in[i-1] & 0xF) << 4;
+}
+
+/* input unaligned, output octet-aligned */
+static void osmo_nibble_shift_left_unal(uint8_t *out, const uint8_t *in,
+					unsigned int num_nibbles)
+{
+	unsigned int i;
+	unsigned int num_whole_bytes = num_nibbles / 2;
+
+	for (i = 0; i < num_whole_bytes; i++)
+		out[i] = ((in[i] & 0xF) << 4) | (in[i+1] >> 4);
+
+	/* shift the last nibble, in case there's an odd count */
+	i = num_whole_bytes;
+	if (num_nibbles & 1)
+		out[i] = (in[i] & 0xF) << 4;
+}
+
+enum repack {
+	REV_SHIFT_RIGHT,
+	SHIFT_RIGHT_REV,
+	REV_SHIFT_LEFT,
+	SHIFT_LEFT_REV,
+	REV_COPY,
+};
+
+struct frame_fmt {
+	const char *name;
+	enum repack repack;
+	unsigned int num;		/* nibbles, octets for REV_COPY */
+};
+
+/* the AMR speech frames of 95, 103, 118, 134, 148, 159, 204 and 244 bits
+ * and the 39 bit SID: as IF2 frame of the L1 with 4 bits of FT in front
+ * and as RTP payload (without CMR and TOC) */
+#define AMR_L1(name, bits)	{ name " L1->RTP", REV_SHIFT_LEFT, \
+				  ((bits) + 4 + 7) / 8 * 2 - 1 }
+#define AMR_RTP(name, bits)	{ name " RTP->L1", SHIFT_RIGHT_REV, \
+				  ((bits) + 7) / 8 * 2 }
+
+static const struct frame_fmt formats[] = {
+	{ "FR L1->RTP", REV_SHIFT_RIGHT, 260/4 },
+	{ "FR RTP->L1", SHIFT_LEFT_REV, 260/4 },
+	{ "EFR L1->RTP", REV_SHIFT_RIGHT, 244/4 },
+	{ "EFR RTP->L1", SHIFT_LEFT_REV, 244/4 },
+	{ "HR", REV_COPY, 14 },
+	AMR_L1("AMR 4.75", 95), AMR_RTP("AMR 4.75", 95),
+	AMR_L1("AMR 5.15", 103), AMR_RTP("AMR 5.15", 103),
+	AMR_L1("AMR 5.9", 118), AMR_RTP("AMR 5.9", 118),
+	AMR_L1("AMR 6.7", 134), AMR_RTP("AMR 6.7", 134),
+	AMR_L1("AMR 7.4", 148), AMR_RTP("AMR 7.4", 148),
+	AMR_L1("AMR 7.95", 159), AMR_RTP("AMR 7.95", 159),
+	AMR_L1("AMR 10.2", 204), AMR_RTP("AMR 10.2", 204),
+	AMR_L1("AMR 12.2", 244), AMR_RTP("AMR 12.2", 244),
+	AMR_L1("AMR SID", 39), AMR_RTP("AMR SID", 39),
+};
+
+static uint32_t rnd_state = 1;
+
+/* xorshift32, so runs are reproducible across C libraries */
+static uint32_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+/* the two pass conversion as tch.c did it before, returns the number
+ * of octets written */
+static unsigned int repack_ref(const struct frame_fmt *fmt, uint8_t *out,
+			       const uint8_t *in)
+{
+	unsigned int n = fmt->num;
+	uint8_t tmp[64];
+
+	switch (fmt->repack) {
+	case REV_SHIFT_RIGHT:
+		memcpy(tmp, in, n/2 + 1);
+		osmo_revbytebits_buf(tmp, n/2 + 1);
+		osmo_nibble_shift_right(out, tmp, n);
+		return n/2 + 1;
+	case SHIFT_RIGHT_REV:
+		osmo_nibble_shift_right(out, in, n);
+		osmo_revbytebits_buf(out, n/2 + 1);
+		return n/2 + 1;
+	case REV_SHIFT_LEFT:
+		memcpy(tmp, in, n/2 + 1);
+		osmo_revbytebits_buf(tmp, n/2 + 1);
+		osmo_nibble_shift_left_unal(out, tmp, n);
+		return (n + 1)/2;
+	case SHIFT_LEFT_REV:
+		osmo_nibble_shift_left_unal(out, in, n);
+		osmo_revbytebits_buf(out, (n + 1)/2);
+		return (n + 1)/2;
+	case REV_COPY:
+		memcpy(out, in, n);
+		osmo_revbytebits_buf(out, n);
+		return n;
+	}
+
+	return 0;
+}
+
+static void repack(const struct frame_fmt *fmt, uint8_t *out,
+		   const uint8_t *in)
+{
+	switch (fmt->repack) {
+	case REV_SHIFT_RIGHT:
+		tch_rev_shift_right(out, in, fmt->num);
+		break;
+	case SHIFT_RIGHT_REV:
+		tch_shift_right_rev(out, in, fmt->num);
+		break;
+	case REV_SHIFT_LEFT:
+		tch_rev_shift_left(out, in, fmt->num);
+		break;
+	case SHIFT_LEFT_REV:
+		tch_shift_left_rev(out, in, fmt->num);
+		break;
+	case REV_COPY:
+		tch_rev_copy(out, in, fmt->num);
+		break;
+	}
+}
+
+static void check_frame(const struct frame_fmt *fmt, const uint8_t *in)
+{
+	uint8_t in_copy[64], out_ref[64], out[64];
+	unsigned int len;
+
+	memcpy(in_copy, in, sizeof(in_copy));
+	memset(out_ref, 0xaa, sizeof(out_ref));
+	memset(out, 0xaa, sizeof(out));
+
+	len = repack_ref(fmt, out_ref, in);
+	repack(fmt, out, in);
+
+	/* same result, nothing written beyond it, input untouched */
+	if (memcmp(out, out_ref, sizeof(out))) {
+		printf("%s mismatch for %s\n", fmt->name,
+			osmo_hexdump(in, len + 1));
+		printf("  expected %s\n", osmo_hexdump(out_ref, len));
+		printf("  got      %s\n", osmo_hexdump(out, len));
+		abort();
+	}
+	ASSERT_TRUE(!memcmp(in, in_copy, sizeof(in_copy)));
+}
+
+static void test_repack(const struct frame_fmt *fmt)
+{
+	uint8_t in[64];
+	unsigned int i, j;
+
+	printf("Testing %s.\n", fmt->name);
+
+	/* every octet value in every position */
+	for (i = 0; i < 256; i++) {
+		memset(in, i, sizeof(in));
+		check_frame(fmt, in);
+		for (j = 0; j < sizeof(in); j++)
+			in[j] = i + j;
+		check_frame(fmt, in);
+	}
+
+	for (i = 0; i < NUM_RANDOM_FRAMES; i++) {
+		for (j = 0; j < sizeof(in); j++)
+			in[j] = rnd();
+		check_frame(fmt, in);
+	}
+}
+
+/* a frame of TS 101 318, with signature and the speech bits, and its
+ * L1 format, with the bits of the last octet beyond the speech bits
+ * set to zero */
+static void test_round_trip(const char *name, unsigned int bits,
+			    uint8_t sig)
+{
+	unsigned int num_nibbles = bits/4;
+	unsigned int len = bits/8 + 1;
+	uint8_t rtp[64], l1[64], out[64];
+	unsigned int i, j;
+
+	printf("Testing %s round trip.\n", name);
+
+	for (i = 0; i < NUM_RANDOM_FRAMES; i++) {
+		/* RTP -> L1 -> RTP */
+		for (j = 0; j < len; j++)
+			rtp[j] = rnd();
+		rtp[0] = (sig << 4) | (rtp[0] & 0x0F);
+		tch_shift_left_rev(l1, rtp, num_nibbles);
+		tch_rev_shift_right(out, l1, num_nibbles);
+		out[0] |= sig << 4;
+		ASSERT_TRUE(!memcmp(out, rtp, len));
+
+		/* L1 -> RTP -> L1 */
+		for (j = 0; j < len; j++)
+			l1[j] = rnd();
+		l1[len-1] &= 0x0F;
+		tch_rev_shift_right(rtp, l1, num_nibbles);
+		rtp[0] |= sig << 4;
+		tch_shift_left_rev(out, rtp, num_nibbles);
+		ASSERT_TRUE(!memcmp(out, l1, len));
+	}
+}
+
+static void test_efr(void)
+{
+	uint8_t rtp[64], l1[64], out[64];
+	unsigned int i;
+
+	printf("Testing EFR conversion.\n");
+
+	/* a valid frame makes it to the L1 and back */
+	for (i = 0; i < GSM_EFR_BYTES; i++)
+		rtp[i] = rnd();
+	rtp[0] = 0xC0 | (rtp[0] & 0x0F);
+	rtp[GSM_EFR_BYTES-1] &= 0xF0;
+	ASSERT_TRUE(tch_rtp_to_l1_efr(l1, rtp, GSM_EFR_BYTES) == GSM_EFR_BYTES);
+	memset(out, 0xaa, sizeof(out));
+	ASSERT_TRUE(tch_l1_to_rtp_efr(out, l1, GSM_EFR_BYTES) == GSM_EFR_BYTES);
+	ASSERT_TRUE(!memcmp(out, rtp, GSM_EFR_BYTES));
+	ASSERT_TRUE(out[GSM_EFR_BYTES] == 0xaa);
+
+	/* the signature of FR is not the one of EFR */
+	rtp[0] = 0xD0 | (rtp[0] & 0x0F);
+	memset(l1, 0xaa, sizeof(l1));
+	ASSERT_TRUE(tch_rtp_to_l1_efr(l1, rtp, GSM_EFR_BYTES) == -EINVAL);
+	ASSERT_TRUE(l1[0] == 0xaa);
+
+	/* short frames in either direction */
+	rtp[0] = 0xC0 | (rtp[0] & 0x0F);
+	ASSERT_TRUE(tch_rtp_to_l1_efr(l1, rtp, GSM_EFR_BYTES-1) == -EINVAL);
+	ASSERT_TRUE(tch_rtp_to_l1_efr(l1, rtp, 0) == -EINVAL);
+	ASSERT_TRUE(l1[0] == 0xaa);
+	ASSERT_TRUE(tch_l1_to_rtp_efr(out, l1, GSM_EFR_BYTES-1) == -EINVAL);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++)
+		test_repack(&formats[i]);
+
+	test_round_trip("FR", 260, 0xD);
+	test_round_trip("EFR", 244, 0xC);
+	test_efr();
+
+	printf("Success\n");
+
+	return 0;
+}